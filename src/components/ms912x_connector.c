@@ -1,5 +1,11 @@
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/module.h>
+
 #include <drm/drm_atomic_state_helper.h>
+#include <drm/drm_managed.h>
 #include <drm/drm_connector.h>
+#include <drm/drm_drv.h>
 #include <drm/drm_edid.h>
 #include <drm/drm_modeset_helper_vtables.h>
 #include <drm/drm_probe_helper.h>
@@ -28,14 +34,10 @@ int ms912x_read_edid_block(struct ms912x_device *ms912x, u8 *buf,
 	const u16 base = 0xc000 + offset;
 	pr_debug("ms912x: reading EDID block at offset %u, len %zu\n", offset, len);
 	
-	for (size_t i = 0; i < len; i++) {
-		u16 address = base + i;
-		int ret = ms912x_read_byte(ms912x, address);
-		if (ret < 0) {
-			pr_err("ms912x: failed to read EDID byte at 0x%04x: %d\n", address, ret);
-			return ret;
-		}
-		buf[i] = ret;
+	int ret = ms912x_read_bytes(ms912x, base, buf, len);
+	if (ret < 0) {
+		pr_err("ms912x: failed to read EDID at 0x%04x: %d\n", base, ret);
+		return ret;
 	}
 	
 	pr_debug("ms912x: successfully read %zu bytes from EDID\n", len);
@@ -49,6 +51,17 @@ int ms912x_read_edid_block(struct ms912x_device *ms912x, u8 *buf,
 	return 0;
 }
 
+static u8 ms912x_edid_checksum(const u8 *block)
+{
+	u8 sum = 0;
+	int i;
+
+	for (i = 0; i < EDID_LENGTH; i++)
+		sum += block[i];
+
+	return sum;
+}
+
 static int ms912x_read_edid(void *data, u8 *buf, unsigned int block, size_t len)
 {
 	// Добавляем проверки на NULL
@@ -72,6 +85,26 @@ static int ms912x_read_edid(void *data, u8 *buf, unsigned int block, size_t len)
 		pr_err("ms912x: failed to read EDID block %u: %d\n", block, ret);
 		return ret;
 	}
+
+	/*
+	 * A corrupt block read in bursts is read again one register at a
+	 * time. If that one is intact, the firmware's replies do not carry
+	 * the following registers and bursts stay off for the device.
+	 */
+	if (len == EDID_LENGTH && READ_ONCE(ms912x->regs.burst) &&
+	    ms912x_edid_checksum(buf)) {
+		WRITE_ONCE(ms912x->regs.burst, false);
+		ret = ms912x_read_edid_block(ms912x, buf, offset, len);
+		if (ret < 0 || ms912x_edid_checksum(buf)) {
+			/* The monitor's EDID is bad, not the bursts */
+			WRITE_ONCE(ms912x->regs.burst, true);
+		} else {
+			pr_warn("ms912x: [%s] burst register reads unreliable, disabled\n",
+				ms912x->device_name);
+		}
+		if (ret < 0)
+			return ret;
+	}
 	
 	pr_debug("ms912x: successfully read EDID block %u\n", block);
 	return ret;
@@ -109,6 +142,139 @@ static void ms912x_add_fallback_mode(struct drm_connector *connector)
 	}
 }
 
+/*
+ * EDID cache
+ *
+ * Reading an EDID block takes several control round trips, so it is only
+ * read after the sink was plugged in: detect() reports the state of
+ * register 0x32, a disconnected -> connected edge drops the cached EDID
+ * and queues edid_work, which reads the new one and then sends a hotplug
+ * event. get_modes() only ever looks at the cache; while the read is
+ * pending it offers the fallback mode and the hotplug event makes
+ * userspace probe again. edid_gen tells the worker that another edge
+ * came in while it was reading and its result is stale.
+ *
+ * A read that fails is retried a few times before the fallback mode
+ * sticks: if the device does not answer, the cache stays pending; if no
+ * EDID comes back, it is cached as not found after the last attempt.
+ */
+
+#define MS912X_EDID_RETRIES 5
+#define MS912X_EDID_RETRY_MS 500
+
+static void ms912x_edid_work(struct work_struct *work)
+{
+	struct ms912x_device *ms912x =
+		container_of(to_delayed_work(work), struct ms912x_device,
+			     edid_work);
+	struct drm_device *drm = &ms912x->drm;
+	const struct drm_edid *edid = NULL;
+	bool connected;
+	unsigned int gen;
+	int status, idx;
+
+	if (!drm_dev_enter(drm, &idx))
+		return;
+
+	mutex_lock(&ms912x->edid_lock);
+	gen = ms912x->edid_gen;
+	mutex_unlock(&ms912x->edid_lock);
+
+	status = ms912x_read_byte(ms912x, 0x32);
+	connected = status == 1;
+	if (connected)
+		edid = drm_edid_read_custom(&ms912x->connector,
+					    ms912x_read_edid, ms912x);
+
+	mutex_lock(&ms912x->edid_lock);
+	if (gen != ms912x->edid_gen) {
+		/* Another edge queued us again */
+		mutex_unlock(&ms912x->edid_lock);
+		drm_edid_free(edid);
+		goto out;
+	}
+	if (status < 0 || (connected && !edid &&
+			   ms912x->edid_retries < MS912X_EDID_RETRIES)) {
+		/* The device did not answer, or the read may have failed */
+		if (ms912x->edid_retries++ < MS912X_EDID_RETRIES)
+			queue_delayed_work(system_wq, &ms912x->edid_work,
+					   msecs_to_jiffies(MS912X_EDID_RETRY_MS));
+		pr_debug("ms912x: [%s] EDID read failed: %d, attempt %u\n",
+			 ms912x->device_name, status, ms912x->edid_retries);
+		mutex_unlock(&ms912x->edid_lock);
+		goto out;
+	}
+	drm_edid_free(ms912x->edid);
+	ms912x->edid = edid;
+	ms912x->edid_connected = connected;
+	ms912x->edid_ready = true;
+	ms912x->edid_reads++;
+	mutex_unlock(&ms912x->edid_lock);
+
+	pr_info("ms912x: [%s] EDID %s\n", ms912x->device_name,
+		!connected ? "not read, no sink" :
+		edid ? "cached" : "not found");
+
+	if (READ_ONCE(drm->registered))
+		drm_kms_helper_hotplug_event(drm);
+out:
+	drm_dev_exit(idx);
+}
+
+/**
+ * ms912x_edid_refresh - Drop the cached EDID and read it again
+ * @ms912x: device
+ *
+ * The read happens on a worker, a hotplug event announces the result.
+ */
+void ms912x_edid_refresh(struct ms912x_device *ms912x)
+{
+	mutex_lock(&ms912x->edid_lock);
+	ms912x->edid_gen++;
+	ms912x->edid_ready = false;
+	ms912x->edid_retries = 0;
+	mutex_unlock(&ms912x->edid_lock);
+
+	mod_delayed_work(system_wq, &ms912x->edid_work, 0);
+}
+
+/*
+ * Called with the state of register 0x32 by detect() and the hotplug
+ * poller. Returns true on a disconnected -> connected edge, edid_work
+ * then sends the hotplug event.
+ */
+static bool ms912x_edid_update_state(struct ms912x_device *ms912x,
+				     bool connected)
+{
+	bool plugged;
+
+	mutex_lock(&ms912x->edid_lock);
+	plugged = connected && !ms912x->edid_connected;
+	ms912x->edid_connected = connected;
+	mutex_unlock(&ms912x->edid_lock);
+
+	if (plugged) {
+		pr_debug("ms912x: [%s] sink plugged in, refreshing EDID\n",
+			 ms912x->device_name);
+		ms912x_edid_refresh(ms912x);
+	}
+
+	return plugged;
+}
+
+void ms912x_edid_init(struct ms912x_device *ms912x)
+{
+	mutex_init(&ms912x->edid_lock);
+	INIT_DELAYED_WORK(&ms912x->edid_work, ms912x_edid_work);
+}
+
+void ms912x_edid_fini(struct ms912x_device *ms912x)
+{
+	cancel_delayed_work_sync(&ms912x->edid_work);
+	drm_edid_free(ms912x->edid);
+	ms912x->edid = NULL;
+}
+
 static int ms912x_connector_get_modes(struct drm_connector *connector)
 {
 	// Добавляем проверку на NULL
@@ -119,21 +285,31 @@ static int ms912x_connector_get_modes(struct drm_connector *connector)
 	
 	int ret = 0;
 	struct ms912x_device *ms912x = to_ms912x(connector->dev);
-	const struct drm_edid *edid;
+	const struct drm_edid *edid = NULL;
+	bool ready;
+
+	mutex_lock(&ms912x->edid_lock);
+	ready = ms912x->edid_ready;
+	if (ready && ms912x->edid)
+		edid = drm_edid_dup(ms912x->edid);
+	mutex_unlock(&ms912x->edid_lock);
+
+	if (!ready) {
+		/* edid_work sends a hotplug event once it has the EDID */
+		pr_debug("ms912x: [%s] EDID read pending, offering fallback mode\n",
+			 ms912x->device_name);
+		drm_edid_connector_update(connector, NULL);
+		ms912x_add_fallback_mode(connector);
+		return 1;
+	}
 
-	pr_debug("ms912x: reading EDID information\n");
-	
-	edid = drm_edid_read_custom(connector, ms912x_read_edid, ms912x);
 	if (!edid) {
 		pr_warn("ms912x: EDID not found, falling back to default mode\n");
+		drm_edid_connector_update(connector, NULL);
 		ms912x_add_fallback_mode(connector);
 		return 1;
 	}
 
-	pr_debug("ms912x: EDID read successfully, updating connector\n");
-	pr_info("ms912x: [%s] EDID read successfully, updating connector with EDID data\n",
-	        ms912x->device_name);
-	
 	ret = drm_edid_connector_update(connector, edid);
 	if (ret < 0) {
 		pr_err("ms912x: failed to update EDID connector: %d\n", ret);
@@ -141,25 +317,9 @@ static int ms912x_connector_get_modes(struct drm_connector *connector)
 		goto edid_free;
 	}
 
-	pr_debug("ms912x: adding modes from EDID\n");
 	ret = drm_edid_connector_add_modes(connector);
-	
-	pr_info("ms912x: added %d modes from EDID\n", ret);
-	
-	// Выводим список видеорежимов, поддерживаемых монитором
-	if (ret > 0) {
-		struct drm_display_mode *mode;
-		int mode_count = 0;
-		
-		pr_info("ms912x: monitor supported video modes:\n");
-		list_for_each_entry(mode, &connector->modes, head) {
-			pr_info("ms912x: mode %d: %dx%d@%dHz flags=0x%x type=0x%x\n",
-			        mode_count, mode->hdisplay, mode->vdisplay,
-			        drm_mode_vrefresh(mode), mode->flags, mode->type);
-			mode_count++;
-		}
-		pr_info("ms912x: total monitor modes: %d\n", mode_count);
-	}
+	pr_debug("ms912x: [%s] added %d modes from cached EDID\n",
+		 ms912x->device_name, ret);
 
 edid_free:
 	drm_edid_free(edid);
@@ -194,18 +354,220 @@ static enum drm_connector_status ms912x_detect(struct drm_connector *connector,
 	enum drm_connector_status result = (status == 1) ? connector_status_connected :
 			       connector_status_disconnected;
 			       
-	pr_debug("ms912x: detect result: %s\n",
-		result == connector_status_connected ? "connected" : "disconnected");
-		
-	// Добавляем дополнительную диагностику после обнаружения
-	pr_info("ms912x: [%s] HDMI detection result: %s (status register: %d)\n",
-	        ms912x->device_name,
-	        result == connector_status_connected ? "connected" : "disconnected",
-	        status);
+	pr_debug("ms912x: [%s] HDMI detection result: %s (status register: %d)\n",
+		 ms912x->device_name,
+		 result == connector_status_connected ? "connected" : "disconnected",
+		 status);
+
+	ms912x_edid_update_state(ms912x, result == connector_status_connected);
 		
 	return result;
 }
 
+/*
+ * Hotplug detection
+ *
+ * The KMS poll helper would call detect(), and with it a register read,
+ * every 10 seconds whether anything changed or not, and only notice a
+ * change that late. Instead hpd_work reads register 0x32 on its own,
+ * starting every MS912X_HPD_MIN_MS and backing off to MS912X_HPD_MAX_MS
+ * while the state stays the same. Only an actual change reaches DRM: a
+ * plug-in through edid_work once the new EDID is cached, an unplug with
+ * a hotplug event right away.
+ *
+ * If the interface has an interrupt IN endpoint, every report on it is
+ * taken as a hint that something changed and checks register 0x32 at
+ * once. What the reports mean is not known, so the poller keeps running
+ * at its slowest rate as a safety net. An endpoint that fails is not
+ * resubmitted; the poller then backs off from its fastest rate again.
+ *
+ * hpd_interval, hpd_hints and hpd_hint_next are shared with the URB
+ * completion and accessed with READ_ONCE()/WRITE_ONCE().
+ */
+
+#define MS912X_HPD_MIN_MS 250
+#define MS912X_HPD_MAX_MS 4000
+
+static void ms912x_hpd_work(struct work_struct *work)
+{
+	struct ms912x_device *ms912x =
+		container_of(to_delayed_work(work), struct ms912x_device,
+			     hpd_work);
+	struct drm_device *drm = &ms912x->drm;
+	unsigned int interval = READ_ONCE(ms912x->hpd_interval);
+	bool connected, changed;
+	int status, idx;
+
+	if (!drm_dev_enter(drm, &idx))
+		return;
+
+	status = ms912x_read_byte(ms912x, 0x32);
+	if (status < 0)
+		goto out;
+
+	connected = status == 1;
+	changed = connected != READ_ONCE(ms912x->sink_connected);
+	WRITE_ONCE(ms912x->sink_connected, connected);
+
+	if (changed) {
+		pr_info("ms912x: [%s] sink %s\n", ms912x->device_name,
+			connected ? "connected" : "disconnected");
+		interval = MS912X_HPD_MIN_MS;
+		if (!ms912x_edid_update_state(ms912x, connected))
+			drm_kms_helper_hotplug_event(drm);
+		/* Send what piled up while the sink was away */
+		if (connected)
+			queue_work(system_highpri_wq, &ms912x->flush_work);
+	} else if (!READ_ONCE(ms912x->hpd_hints)) {
+		interval = min_t(unsigned int, interval * 2,
+				 MS912X_HPD_MAX_MS);
+	} else {
+		interval = MS912X_HPD_MAX_MS;
+	}
+	WRITE_ONCE(ms912x->hpd_interval, interval);
+
+out:
+	queue_delayed_work(system_wq, &ms912x->hpd_work,
+			   msecs_to_jiffies(interval));
+	drm_dev_exit(idx);
+}
+
+static void ms912x_hpd_irq(struct urb *urb)
+{
+	struct ms912x_device *ms912x = urb->context;
+
+	switch (urb->status) {
+	case 0:
+		/* A chatty endpoint must not turn into a register read storm */
+		if (time_after_eq(jiffies, READ_ONCE(ms912x->hpd_hint_next))) {
+			WRITE_ONCE(ms912x->hpd_hint_next,
+				   jiffies + msecs_to_jiffies(MS912X_HPD_MIN_MS));
+			mod_delayed_work(system_wq, &ms912x->hpd_work, 0);
+		}
+		break;
+	case -ENOENT:
+	case -ECONNRESET:
+	case -ESHUTDOWN:
+		return;
+	default:
+		/*
+		 * -EPIPE, -EPROTO and the like do not go away by asking
+		 * again, leave it to the poller until the next hpd_start.
+		 */
+		pr_warn("ms912x: [%s] interrupt endpoint failed: %d, polling only\n",
+			ms912x->device_name, urb->status);
+		WRITE_ONCE(ms912x->hpd_hints, false);
+		WRITE_ONCE(ms912x->hpd_interval, MS912X_HPD_MIN_MS);
+		mod_delayed_work(system_wq, &ms912x->hpd_work, 0);
+		return;
+	}
+
+	usb_submit_urb(urb, GFP_ATOMIC);
+}
+
+static void ms912x_hpd_release(struct drm_device *drm, void *data)
+{
+	struct ms912x_device *ms912x = data;
+
+	usb_free_urb(ms912x->hpd_urb);
+	ms912x->hpd_urb = NULL;
+}
+
+/**
+ * ms912x_hpd_init - Set up hotplug detection
+ * @ms912x: device
+ *
+ * Uses the interface's interrupt IN endpoint if it has one. The state of
+ * the sink is assumed to be what edid_work found at probe.
+ */
+int ms912x_hpd_init(struct ms912x_device *ms912x)
+{
+	struct usb_host_interface *alt = ms912x->intf->cur_altsetting;
+	struct usb_device *usb_dev = interface_to_usbdev(ms912x->intf);
+	struct usb_endpoint_descriptor *ep;
+	size_t len;
+	int ret;
+
+	INIT_DELAYED_WORK(&ms912x->hpd_work, ms912x_hpd_work);
+	WRITE_ONCE(ms912x->hpd_interval, MS912X_HPD_MIN_MS);
+	WRITE_ONCE(ms912x->sink_connected, true);
+
+	if (usb_find_int_in_endpoint(alt, &ep))
+		return 0;
+
+	len = usb_endpoint_maxp(ep);
+	ms912x->hpd_buf = drmm_kzalloc(&ms912x->drm, len, GFP_KERNEL);
+	if (!ms912x->hpd_buf)
+		return -ENOMEM;
+	ms912x->hpd_urb = usb_alloc_urb(0, GFP_KERNEL);
+	if (!ms912x->hpd_urb)
+		return -ENOMEM;
+	ret = drmm_add_action_or_reset(&ms912x->drm, ms912x_hpd_release,
+				       ms912x);
+	if (ret)
+		return ret;
+
+	usb_fill_int_urb(ms912x->hpd_urb, usb_dev,
+			 usb_rcvintpipe(usb_dev, usb_endpoint_num(ep)),
+			 ms912x->hpd_buf, len, ms912x_hpd_irq, ms912x,
+			 ep->bInterval);
+
+	pr_info("ms912x: [%s] hotplug hints from interrupt endpoint 0x%02x\n",
+		ms912x->device_name, ep->bEndpointAddress);
+	return 0;
+}
+
+void ms912x_hpd_start(struct ms912x_device *ms912x)
+{
+	mutex_lock(&ms912x->edid_lock);
+	WRITE_ONCE(ms912x->sink_connected, ms912x->edid_connected);
+	mutex_unlock(&ms912x->edid_lock);
+
+	WRITE_ONCE(ms912x->hpd_interval, MS912X_HPD_MIN_MS);
+	WRITE_ONCE(ms912x->hpd_hints, !!ms912x->hpd_urb);
+	if (ms912x->hpd_urb && usb_submit_urb(ms912x->hpd_urb, GFP_KERNEL)) {
+		WRITE_ONCE(ms912x->hpd_hints, false);
+		pr_warn("ms912x: [%s] interrupt endpoint unusable, polling only\n",
+			ms912x->device_name);
+	}
+
+	queue_delayed_work(system_wq, &ms912x->hpd_work,
+			   msecs_to_jiffies(MS912X_HPD_MIN_MS));
+}
+
+void ms912x_hpd_stop(struct ms912x_device *ms912x)
+{
+	usb_kill_urb(ms912x->hpd_urb);
+	cancel_delayed_work_sync(&ms912x->hpd_work);
+}
+
+static ssize_t ms912x_edid_refresh_write(struct file *file,
+					 const char __user *buf, size_t len,
+					 loff_t *ppos)
+{
+	struct ms912x_device *ms912x = file->private_data;
+
+	ms912x_edid_refresh(ms912x);
+
+	return len;
+}
+
+static const struct file_operations ms912x_edid_refresh_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = ms912x_edid_refresh_write,
+	.llseek = noop_llseek,
+};
+
+/* Writing anything to ms912x_edid_refresh reads the EDID again */
+static void ms912x_connector_debugfs_init(struct drm_connector *connector,
+					  struct dentry *root)
+{
+	debugfs_create_file("ms912x_edid_refresh", 0200, root,
+			    to_ms912x(connector->dev),
+			    &ms912x_edid_refresh_fops);
+}
+
 static const struct drm_connector_helper_funcs ms912x_connector_helper_funcs = {
 	.get_modes = ms912x_connector_get_modes,
 };
@@ -217,6 +579,7 @@ static const struct drm_connector_funcs ms912x_connector_funcs = {
 	.reset = drm_atomic_helper_connector_reset,
 	.atomic_duplicate_state = drm_atomic_helper_connector_duplicate_state,
 	.atomic_destroy_state = drm_atomic_helper_connector_destroy_state,
+	.debugfs_init = ms912x_connector_debugfs_init,
 };
 
 int ms912x_connector_init(struct ms912x_device *ms912x)
@@ -239,11 +602,8 @@ int ms912x_connector_init(struct ms912x_device *ms912x)
 	
 	pr_info("ms912x: [%s] connector initialized successfully\n", ms912x->device_name);
 
-	ms912x->connector.polled =
-		DRM_CONNECTOR_POLL_CONNECT | DRM_CONNECTOR_POLL_DISCONNECT;
-
-	pr_info("ms912x: [%s] connector polling enabled: CONNECT|DISCONNECT\n",
-	        ms912x->device_name);
+	/* ms912x_hpd_work() reports changes, the poll helper stays out */
+	ms912x->connector.polled = DRM_CONNECTOR_POLL_HPD;
 
 	return 0;
 }
@@ -0,0 +1,494 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/string.h>
+
+#include <drm/drm_fourcc.h>
+
+#ifdef CONFIG_X86
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+#endif
+
+#include "ms912x_convert.h"
+
+/*
+ * Packed lookup tables, one per channel, generated by the preprocessor.
+ *
+ * Each entry holds the Y, U and V contribution of one channel value in
+ * three 21-bit lanes, so a pixel costs one load and one add per channel.
+ * A negative coefficient c is stored as -c * (255 - x), which is c * x
+ * shifted up by -c * 255; that shift and the rounding/offset biases are
+ * folded into the red table. Every lane therefore stays non-negative and
+ * below 0x10000, no lane can borrow from or carry into its neighbour, and
+ * the result never needs clamping.
+ */
+#define MS912X_LUT_SHIFT_U 21
+#define MS912X_LUT_SHIFT_V 42
+
+#define MS912X_LUT_TERM(c, x) ((c) >= 0 ? (c) * (x) : -(c) * (255 - (x)))
+#define MS912X_LUT_NEG(c) ((c) < 0 ? (c) * 255 : 0)
+
+#define MS912X_LUT_Y_BIAS                                                      \
+	(MS912X_Y_BIAS + MS912X_LUT_NEG(MS912X_Y_R) +                          \
+	 MS912X_LUT_NEG(MS912X_Y_G) + MS912X_LUT_NEG(MS912X_Y_B))
+#define MS912X_LUT_U_BIAS                                                      \
+	(MS912X_UV_BIAS + MS912X_LUT_NEG(MS912X_U_R) +                         \
+	 MS912X_LUT_NEG(MS912X_U_G) + MS912X_LUT_NEG(MS912X_U_B))
+#define MS912X_LUT_V_BIAS                                                      \
+	(MS912X_UV_BIAS + MS912X_LUT_NEG(MS912X_V_R) +                         \
+	 MS912X_LUT_NEG(MS912X_V_G) + MS912X_LUT_NEG(MS912X_V_B))
+
+#define MS912X_LUT_ENTRY(cy, cu, cv, bias_y, bias_u, bias_v, x)                \
+	((u64)(MS912X_LUT_TERM(cy, x) + (bias_y)) |                            \
+	 (u64)(MS912X_LUT_TERM(cu, x) + (bias_u)) << MS912X_LUT_SHIFT_U |      \
+	 (u64)(MS912X_LUT_TERM(cv, x) + (bias_v)) << MS912X_LUT_SHIFT_V)
+
+#define MS912X_LUT_R(x)                                                        \
+	MS912X_LUT_ENTRY(MS912X_Y_R, MS912X_U_R, MS912X_V_R,                   \
+			 MS912X_LUT_Y_BIAS, MS912X_LUT_U_BIAS,                 \
+			 MS912X_LUT_V_BIAS, x)
+#define MS912X_LUT_G(x)                                                        \
+	MS912X_LUT_ENTRY(MS912X_Y_G, MS912X_U_G, MS912X_V_G, 0, 0, 0, x)
+#define MS912X_LUT_B(x)                                                        \
+	MS912X_LUT_ENTRY(MS912X_Y_B, MS912X_U_B, MS912X_V_B, 0, 0, 0, x)
+
+#define MS912X_LUT4(f, x) f(x), f((x) + 1), f((x) + 2), f((x) + 3)
+#define MS912X_LUT16(f, x)                                                     \
+	MS912X_LUT4(f, x), MS912X_LUT4(f, (x) + 4), MS912X_LUT4(f, (x) + 8),   \
+		MS912X_LUT4(f, (x) + 12)
+#define MS912X_LUT64(f, x)                                                     \
+	MS912X_LUT16(f, x), MS912X_LUT16(f, (x) + 16),                         \
+		MS912X_LUT16(f, (x) + 32), MS912X_LUT16(f, (x) + 48)
+#define MS912X_LUT256(f)                                                       \
+	MS912X_LUT64(f, 0), MS912X_LUT64(f, 64), MS912X_LUT64(f, 128),         \
+		MS912X_LUT64(f, 192)
+
+static_assert(MS912X_LUT_Y_BIAS >= 0 && MS912X_LUT_U_BIAS >= 0 &&
+	      MS912X_LUT_V_BIAS >= 0);
+
+static const u64 ms912x_lut_r[256] = { MS912X_LUT256(MS912X_LUT_R) };
+static const u64 ms912x_lut_g[256] = { MS912X_LUT256(MS912X_LUT_G) };
+static const u64 ms912x_lut_b[256] = { MS912X_LUT256(MS912X_LUT_B) };
+
+static inline u64 ms912x_rgb_to_yuv(unsigned int r, unsigned int g,
+				    unsigned int b)
+{
+	return ms912x_lut_r[r] + ms912x_lut_g[g] + ms912x_lut_b[b];
+}
+
+static inline u8 ms912x_yuv_y(u64 yuv)
+{
+	return yuv >> 8;
+}
+
+static inline u8 ms912x_yuv_u(u64 yuv)
+{
+	return yuv >> (MS912X_LUT_SHIFT_U + 8);
+}
+
+static inline u8 ms912x_yuv_v(u64 yuv)
+{
+	return yuv >> (MS912X_LUT_SHIFT_V + 8);
+}
+
+/**
+ * ms912x_xrgb_to_uyvy_scalar - Reference XRGB8888 to UYVY line conversion
+ * @dst: destination, 2 bytes per pixel
+ * @line: source pixels
+ * @width: number of pixels, must be even
+ *
+ * Luma is computed per pixel, chroma from the average of each pixel pair.
+ * This is the fallback on hosts without a vector kernel, and the vector
+ * kernels use it for the tail of a line that does not fill a whole vector.
+ */
+void ms912x_xrgb_to_uyvy_scalar(u8 *dst, const void *line, unsigned int width)
+{
+	const u32 *src = line;
+	unsigned int i, dst_offset = 0;
+	unsigned int pixel1, pixel2;
+	unsigned int r1, g1, b1, r2, g2, b2;
+	u64 chroma;
+
+	for (i = 0; i < width; i += 2) {
+		pixel1 = src[i];
+		pixel2 = src[i + 1];
+
+		r1 = (pixel1 >> 16) & 0xFF;
+		g1 = (pixel1 >> 8) & 0xFF;
+		b1 = pixel1 & 0xFF;
+		r2 = (pixel2 >> 16) & 0xFF;
+		g2 = (pixel2 >> 8) & 0xFF;
+		b2 = pixel2 & 0xFF;
+
+		chroma = ms912x_rgb_to_yuv((r1 + r2) >> 1, (g1 + g2) >> 1,
+					   (b1 + b2) >> 1);
+
+		dst[dst_offset++] = ms912x_yuv_u(chroma);
+		dst[dst_offset++] = ms912x_yuv_y(ms912x_rgb_to_yuv(r1, g1, b1));
+		dst[dst_offset++] = ms912x_yuv_v(chroma);
+		dst[dst_offset++] = ms912x_yuv_y(ms912x_rgb_to_yuv(r2, g2, b2));
+	}
+}
+
+const struct ms912x_convert_kernel ms912x_convert_scalar = {
+	.name = "scalar",
+	.needs_fpu = false,
+	.line = ms912x_xrgb_to_uyvy_scalar,
+};
+
+/*
+ * Other plane formats
+ *
+ * XRGB8888 to UYVY has the vector kernels above. The formats below are
+ * converted by portable kernels built from one generic line loop each;
+ * the format is a constant in every caller, so the compiler drops the
+ * switch from the inner loop. UYVY planes are copied as they are and
+ * YUYV ones only byte-swapped.
+ */
+
+/*
+ * Only the register value for the RGB wire format is known from captures,
+ * the byte order of its payload is R, G, B unless this says otherwise.
+ */
+static bool rgb_bgr;
+module_param(rgb_bgr, bool, 0644);
+MODULE_PARM_DESC(rgb_bgr,
+		 "Send RGB modes in B, G, R byte order, for devices that show red and blue swapped (default: false)");
+
+/* R, G and B of pixel @i of @line in @format */
+static __always_inline void ms912x_rgb_fetch(const void *line, unsigned int i,
+					     u32 format, unsigned int *r,
+					     unsigned int *g, unsigned int *b)
+{
+	unsigned int p;
+
+	switch (format) {
+	case DRM_FORMAT_XBGR8888:
+		p = ((const u32 *)line)[i];
+		*r = p & 0xff;
+		*g = (p >> 8) & 0xff;
+		*b = (p >> 16) & 0xff;
+		break;
+	case DRM_FORMAT_RGB565:
+		p = ((const u16 *)line)[i];
+		*r = (p >> 11) << 3 | (p >> 13);
+		*g = ((p >> 5) & 0x3f) << 2 | ((p >> 9) & 0x3);
+		*b = (p & 0x1f) << 3 | ((p >> 2) & 0x7);
+		break;
+	default: /* XRGB8888, ARGB8888 */
+		p = ((const u32 *)line)[i];
+		*r = (p >> 16) & 0xff;
+		*g = (p >> 8) & 0xff;
+		*b = p & 0xff;
+		break;
+	}
+}
+
+static __always_inline void ms912x_rgb_line_to_uyvy(u8 *dst, const void *line,
+						    unsigned int width,
+						    u32 format)
+{
+	unsigned int i, r1, g1, b1, r2, g2, b2;
+	u64 chroma;
+
+	for (i = 0; i < width; i += 2) {
+		ms912x_rgb_fetch(line, i, format, &r1, &g1, &b1);
+		ms912x_rgb_fetch(line, i + 1, format, &r2, &g2, &b2);
+
+		chroma = ms912x_rgb_to_yuv((r1 + r2) >> 1, (g1 + g2) >> 1,
+					   (b1 + b2) >> 1);
+
+		*dst++ = ms912x_yuv_u(chroma);
+		*dst++ = ms912x_yuv_y(ms912x_rgb_to_yuv(r1, g1, b1));
+		*dst++ = ms912x_yuv_v(chroma);
+		*dst++ = ms912x_yuv_y(ms912x_rgb_to_yuv(r2, g2, b2));
+	}
+}
+
+/* Packed 24-bit RGB, R, G, B byte order or B, G, R with rgb_bgr */
+static __always_inline void ms912x_rgb_line_to_rgb(u8 *dst, const void *line,
+						   unsigned int width,
+						   u32 format)
+{
+	unsigned int ro = READ_ONCE(rgb_bgr) ? 2 : 0, bo = 2 - ro;
+	unsigned int i, r, g, b;
+
+	for (i = 0; i < width; i++, dst += 3) {
+		ms912x_rgb_fetch(line, i, format, &r, &g, &b);
+		dst[ro] = r;
+		dst[1] = g;
+		dst[bo] = b;
+	}
+}
+
+/* @u, @y and @v are the offsets of U, the first Y and V in a pixel pair */
+static __always_inline void ms912x_yuv_line_to_rgb(u8 *dst, const void *line,
+						   unsigned int width,
+						   unsigned int u,
+						   unsigned int y,
+						   unsigned int v)
+{
+	unsigned int ro = READ_ONCE(rgb_bgr) ? 2 : 0, bo = 2 - ro;
+	const u8 *src = line;
+	unsigned int i, j;
+	int cu, cv, c;
+
+	for (i = 0; i < width * 2; i += 4) {
+		cu = src[i + u] - 128;
+		cv = src[i + v] - 128;
+
+		for (j = 0; j < 4; j += 2, dst += 3) {
+			c = MS912X_RGB_Y * (src[i + y + j] - 16) + 128;
+			dst[ro] = clamp((c + MS912X_R_V * cv) >> 8, 0, 255);
+			dst[1] = clamp((c - MS912X_G_U * cu - MS912X_G_V * cv) >>
+				       8, 0, 255);
+			dst[bo] = clamp((c + MS912X_B_U * cu) >> 8, 0, 255);
+		}
+	}
+}
+
+#define MS912X_RGB_KERNEL(fmt, src, wire)                                      \
+	static void ms912x_##src##_to_##wire(u8 *dst, const void *line,       \
+					     unsigned int width)               \
+	{                                                                      \
+		ms912x_rgb_line_to_##wire(dst, line, width, fmt);             \
+	}                                                                      \
+	static const struct ms912x_convert_kernel ms912x_##src##_##wire = {   \
+		.name = #src "-" #wire,                                        \
+		.line = ms912x_##src##_to_##wire,                              \
+	}
+
+/* XRGB8888 to UYVY is the job of the selectable kernels above */
+MS912X_RGB_KERNEL(DRM_FORMAT_XRGB8888, xrgb, rgb);
+MS912X_RGB_KERNEL(DRM_FORMAT_XBGR8888, xbgr, uyvy);
+MS912X_RGB_KERNEL(DRM_FORMAT_XBGR8888, xbgr, rgb);
+MS912X_RGB_KERNEL(DRM_FORMAT_RGB565, rgb565, uyvy);
+MS912X_RGB_KERNEL(DRM_FORMAT_RGB565, rgb565, rgb);
+
+static void ms912x_uyvy_copy(u8 *dst, const void *line, unsigned int width)
+{
+	memcpy(dst, line, width * 2);
+}
+
+static void ms912x_yuyv_to_uyvy(u8 *dst, const void *line, unsigned int width)
+{
+	const u8 *src = line;
+	unsigned int i;
+
+	for (i = 0; i < width * 2; i += 4) {
+		dst[i] = src[i + 1];
+		dst[i + 1] = src[i];
+		dst[i + 2] = src[i + 3];
+		dst[i + 3] = src[i + 2];
+	}
+}
+
+static void ms912x_uyvy_to_rgb(u8 *dst, const void *line, unsigned int width)
+{
+	ms912x_yuv_line_to_rgb(dst, line, width, 0, 1, 2);
+}
+
+static void ms912x_yuyv_to_rgb(u8 *dst, const void *line, unsigned int width)
+{
+	ms912x_yuv_line_to_rgb(dst, line, width, 1, 0, 3);
+}
+
+static const struct ms912x_convert_kernel ms912x_uyvy_uyvy = {
+	.name = "uyvy-copy",
+	.line = ms912x_uyvy_copy,
+};
+
+static const struct ms912x_convert_kernel ms912x_yuyv_uyvy = {
+	.name = "yuyv-uyvy",
+	.line = ms912x_yuyv_to_uyvy,
+};
+
+static const struct ms912x_convert_kernel ms912x_uyvy_rgb = {
+	.name = "uyvy-rgb",
+	.line = ms912x_uyvy_to_rgb,
+};
+
+static const struct ms912x_convert_kernel ms912x_yuyv_rgb = {
+	.name = "yuyv-rgb",
+	.line = ms912x_yuyv_to_rgb,
+};
+
+/**
+ * ms912x_convert_find - Pick the kernel for a plane format
+ * @format: DRM fourcc of the framebuffer
+ * @rgb: the mode is sent as MS912X_PIXFMT_RGB rather than UYVY
+ *
+ * XRGB8888 and ARGB8888 to UYVY use the kernel from ms912x_convert_get(),
+ * alpha is ignored. Returns NULL for formats the plane does not offer.
+ */
+const struct ms912x_convert_kernel *ms912x_convert_find(u32 format, bool rgb)
+{
+	switch (format) {
+	case DRM_FORMAT_XRGB8888:
+	case DRM_FORMAT_ARGB8888:
+		return rgb ? &ms912x_xrgb_rgb : ms912x_convert_get();
+	case DRM_FORMAT_XBGR8888:
+		return rgb ? &ms912x_xbgr_rgb : &ms912x_xbgr_uyvy;
+	case DRM_FORMAT_RGB565:
+		return rgb ? &ms912x_rgb565_rgb : &ms912x_rgb565_uyvy;
+	case DRM_FORMAT_UYVY:
+		return rgb ? &ms912x_uyvy_rgb : &ms912x_uyvy_uyvy;
+	case DRM_FORMAT_YUYV:
+		return rgb ? &ms912x_yuyv_rgb : &ms912x_yuyv_uyvy;
+	default:
+		return NULL;
+	}
+}
+
+#ifdef CONFIG_X86
+/*
+ * CPU checks of the vector kernels. They live here rather than next to
+ * the kernels, whose objects are built with -msse2/-mavx2 and may use
+ * those instructions anywhere, a check included, on a CPU without them.
+ */
+bool ms912x_sse2_available(void)
+{
+	return boot_cpu_has(X86_FEATURE_XMM2);
+}
+
+bool ms912x_avx2_available(void)
+{
+	return boot_cpu_has(X86_FEATURE_AVX) &&
+	       boot_cpu_has(X86_FEATURE_AVX2) &&
+	       cpu_has_xfeatures(XFEATURE_MASK_SSE | XFEATURE_MASK_YMM, NULL);
+}
+
+bool ms912x_copy_from_wc_available(void)
+{
+	return boot_cpu_has(X86_FEATURE_XMM4_1);
+}
+#endif
+
+/* Ordered from most to least preferred */
+static const struct ms912x_convert_kernel *const ms912x_convert_kernels[] = {
+#ifdef CONFIG_X86
+	&ms912x_convert_avx2,
+	&ms912x_convert_sse2,
+#endif
+	&ms912x_convert_scalar,
+};
+
+static const struct ms912x_convert_kernel *ms912x_active_kernel;
+
+static bool ms912x_convert_available(const struct ms912x_convert_kernel *kernel)
+{
+	return !kernel->available || kernel->available();
+}
+
+static const struct ms912x_convert_kernel *ms912x_convert_best(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ms912x_convert_kernels); i++) {
+		if (ms912x_convert_available(ms912x_convert_kernels[i]))
+			return ms912x_convert_kernels[i];
+	}
+
+	return &ms912x_convert_scalar;
+}
+
+static int convert_kernel_set(const char *val, const struct kernel_param *kp)
+{
+	const struct ms912x_convert_kernel *kernel = NULL;
+	int i;
+
+	if (sysfs_streq(val, "auto")) {
+		kernel = ms912x_convert_best();
+	} else {
+		for (i = 0; i < ARRAY_SIZE(ms912x_convert_kernels); i++) {
+			if (sysfs_streq(val, ms912x_convert_kernels[i]->name)) {
+				kernel = ms912x_convert_kernels[i];
+				break;
+			}
+		}
+	}
+
+	if (!kernel) {
+		pr_err("ms912x: unknown conversion kernel: %s\n", val);
+		return -EINVAL;
+	}
+
+	if (!ms912x_convert_available(kernel)) {
+		pr_err("ms912x: conversion kernel %s is not supported by this CPU\n",
+		       kernel->name);
+		return -ENODEV;
+	}
+
+	WRITE_ONCE(ms912x_active_kernel, kernel);
+	pr_info("ms912x: using %s conversion kernel\n", kernel->name);
+
+	return 0;
+}
+
+static int convert_kernel_get(char *buffer, const struct kernel_param *kp)
+{
+	return sysfs_emit(buffer, "%s\n", ms912x_convert_get()->name);
+}
+
+static const struct kernel_param_ops convert_kernel_ops = {
+	.set = convert_kernel_set,
+	.get = convert_kernel_get,
+};
+
+module_param_cb(convert_kernel, &convert_kernel_ops, NULL, 0644);
+MODULE_PARM_DESC(convert_kernel,
+		 "XRGB8888 to UYVY conversion kernel: auto, avx2, sse2 or scalar (default: auto)");
+
+/**
+ * ms912x_convert_get - Return the conversion kernel to use for the next rect
+ *
+ * The result must be passed unchanged to ms912x_convert_begin() and
+ * ms912x_convert_end(), so that switching the kernel through the module
+ * parameter in the middle of a rect can not unbalance the FPU section.
+ */
+const struct ms912x_convert_kernel *ms912x_convert_get(void)
+{
+	const struct ms912x_convert_kernel *kernel =
+		READ_ONCE(ms912x_active_kernel);
+
+	return kernel ? kernel : &ms912x_convert_scalar;
+}
+
+/**
+ * ms912x_convert_begin - Enter the FPU section a conversion needs
+ * @kernel: kernel from ms912x_convert_find()
+ * @stream: lines are read with ms912x_copy_from_wc()
+ */
+void ms912x_convert_begin(const struct ms912x_convert_kernel *kernel,
+			  bool stream)
+{
+#ifdef CONFIG_X86
+	if (kernel->needs_fpu || stream)
+		kernel_fpu_begin();
+#endif
+}
+
+void ms912x_convert_end(const struct ms912x_convert_kernel *kernel,
+			bool stream)
+{
+#ifdef CONFIG_X86
+	if (kernel->needs_fpu || stream)
+		kernel_fpu_end();
+#endif
+}
+
+/**
+ * ms912x_convert_init - Select the conversion kernel at module load
+ *
+ * Picks the fastest kernel supported by the CPU unless the convert_kernel
+ * parameter already selected one.
+ */
+void ms912x_convert_init(void)
+{
+	if (!READ_ONCE(ms912x_active_kernel))
+		WRITE_ONCE(ms912x_active_kernel, ms912x_convert_best());
+
+	pr_info("ms912x: using %s conversion kernel\n",
+		ms912x_convert_get()->name);
+}
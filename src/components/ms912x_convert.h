@@ -0,0 +1,96 @@
+#ifndef MS912X_CONVERT_H
+#define MS912X_CONVERT_H
+
+#include <linux/types.h>
+
+/*
+ * BT.601 limited range RGB -> YUV coefficients scaled by 2^8.
+ *
+ * Y = (66 * R + 129 * G + 25 * B + 128) / 256 + 16
+ * U = (-38 * R - 74 * G + 112 * B + 128) / 256 + 128
+ * V = (112 * R - 94 * G - 18 * B + 128) / 256 + 128
+ *
+ * Every kernel must produce bit-identical output to the scalar reference,
+ * so the rounding and the way chroma is taken from the average of a pixel
+ * pair are part of this definition.
+ */
+#define MS912X_Y_R 66
+#define MS912X_Y_G 129
+#define MS912X_Y_B 25
+#define MS912X_U_R (-38)
+#define MS912X_U_G (-74)
+#define MS912X_U_B 112
+#define MS912X_V_R 112
+#define MS912X_V_G (-94)
+#define MS912X_V_B (-18)
+
+#define MS912X_Y_BIAS ((16 << 8) + 128)
+#define MS912X_UV_BIAS ((128 << 8) + 128)
+
+/*
+ * The inverse, for YUV planes sent as RGB:
+ *
+ * R = (298 * (Y - 16) + 409 * (V - 128) + 128) / 256
+ * G = (298 * (Y - 16) - 100 * (U - 128) - 208 * (V - 128) + 128) / 256
+ * B = (298 * (Y - 16) + 516 * (U - 128) + 128) / 256
+ */
+#define MS912X_R_V 409
+#define MS912X_G_U 100
+#define MS912X_G_V 208
+#define MS912X_B_U 516
+#define MS912X_RGB_Y 298
+
+/**
+ * struct ms912x_convert_kernel - Plane to wire format line conversion kernel
+ * @name: name accepted by the convert_kernel module parameter
+ * @needs_fpu: kernel uses vector registers and must run between
+ *             kernel_fpu_begin() and kernel_fpu_end()
+ * @available: returns true if the running CPU can execute the kernel,
+ *             NULL means always available
+ * @line: converts @width pixels (must be even) from @src, in the plane's
+ *        format, into the wire format at @dst
+ */
+struct ms912x_convert_kernel {
+	const char *name;
+	bool needs_fpu;
+	bool (*available)(void);
+	void (*line)(u8 *dst, const void *src, unsigned int width);
+};
+
+extern const struct ms912x_convert_kernel ms912x_convert_scalar;
+#ifdef CONFIG_X86
+extern const struct ms912x_convert_kernel ms912x_convert_sse2;
+extern const struct ms912x_convert_kernel ms912x_convert_avx2;
+
+/* Built without vector flags, unlike the kernels, see ms912x_convert.c */
+bool ms912x_sse2_available(void);
+bool ms912x_avx2_available(void);
+#endif
+
+void ms912x_xrgb_to_uyvy_scalar(u8 *dst, const void *line, unsigned int width);
+
+/* Streaming loads for framebuffers in write-combined or I/O memory */
+#ifdef CONFIG_X86
+bool ms912x_copy_from_wc_available(void);
+void ms912x_copy_from_wc(void *dst, const void __iomem *src, size_t len);
+#else
+static inline bool ms912x_copy_from_wc_available(void)
+{
+	return false;
+}
+
+static inline void ms912x_copy_from_wc(void *dst, const void __iomem *src,
+				       size_t len)
+{
+}
+#endif
+
+const struct ms912x_convert_kernel *ms912x_convert_get(void);
+const struct ms912x_convert_kernel *ms912x_convert_find(u32 format, bool rgb);
+void ms912x_convert_begin(const struct ms912x_convert_kernel *kernel,
+			  bool stream);
+void ms912x_convert_end(const struct ms912x_convert_kernel *kernel,
+			bool stream);
+void ms912x_convert_init(void);
+
+#endif // MS912X_CONVERT_H
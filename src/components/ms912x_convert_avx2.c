@@ -0,0 +1,91 @@
+#include <linux/types.h>
+
+#include "ms912x_convert.h"
+
+/*
+ * Built with -mavx2 (see Makefile), only ever called between
+ * kernel_fpu_begin() and kernel_fpu_end().
+ */
+
+typedef int v8si __attribute__((vector_size(32)));
+typedef unsigned int v8su __attribute__((vector_size(32)));
+typedef long long v4di __attribute__((vector_size(32)));
+typedef unsigned long long v4du __attribute__((vector_size(32)));
+typedef unsigned short v16hu __attribute__((vector_size(32)));
+
+typedef unsigned int v8su_u
+	__attribute__((vector_size(32), aligned(1), may_alias));
+typedef unsigned short v16hu_u
+	__attribute__((vector_size(32), aligned(1), may_alias));
+
+/*
+ * vpackssdw works within 128-bit lanes, so the result holds the pixels
+ * in 64-bit chunk order 0, 2, 1, 3. Every step up to the store is lane
+ * wise, so the order is fixed once with vpermq right before the store.
+ */
+static inline v16hu ms912x_avx2_pack(v8su lo, v8su hi)
+{
+	return (v16hu)__builtin_ia32_packssdw256((v8si)lo, (v8si)hi);
+}
+
+static inline v8su ms912x_avx2_pair_avg(v8su c)
+{
+	v4du q = (v4du)c;
+
+	return (v8su)(((q & 0xffffffffULL) + (q >> 32)) >> 1);
+}
+
+/**
+ * ms912x_avx2_line - Convert a line to UYVY 16 pixels at a time
+ * @dst: destination, 2 bytes per pixel
+ * @line: source pixels in XRGB8888
+ * @width: number of pixels, must be even
+ *
+ * Same arithmetic as the SSE2 kernel on 256-bit vectors.
+ */
+static void ms912x_avx2_line(u8 *dst, const void *line, unsigned int width)
+{
+	const u32 *src = line;
+	unsigned int i;
+
+	for (i = 0; i + 16 <= width; i += 16) {
+		v8su a = *(const v8su_u *)(src + i);
+		v8su b = *(const v8su_u *)(src + i + 8);
+		v8su ra = (a >> 16) & 0xff, rb = (b >> 16) & 0xff;
+		v8su ga = (a >> 8) & 0xff, gb = (b >> 8) & 0xff;
+		v8su ba = a & 0xff, bb = b & 0xff;
+		v16hu r, g, bl, rc, gc, bc, y, u, v, c;
+
+		r = ms912x_avx2_pack(ra, rb);
+		g = ms912x_avx2_pack(ga, gb);
+		bl = ms912x_avx2_pack(ba, bb);
+		y = (r * MS912X_Y_R + g * MS912X_Y_G + bl * MS912X_Y_B +
+		     MS912X_Y_BIAS) >> 8;
+
+		rc = ms912x_avx2_pack(ms912x_avx2_pair_avg(ra),
+				      ms912x_avx2_pair_avg(rb));
+		gc = ms912x_avx2_pack(ms912x_avx2_pair_avg(ga),
+				      ms912x_avx2_pair_avg(gb));
+		bc = ms912x_avx2_pack(ms912x_avx2_pair_avg(ba),
+				      ms912x_avx2_pair_avg(bb));
+		u = (bc * MS912X_U_B - rc * -MS912X_U_R - gc * -MS912X_U_G +
+		     MS912X_UV_BIAS) >> 8;
+		v = (rc * MS912X_V_R - gc * -MS912X_V_G - bc * -MS912X_V_B +
+		     MS912X_UV_BIAS) >> 8;
+
+		c = (v16hu)(((v8su)u & 0xffff) | ((v8su)v << 16));
+		c |= y << 8;
+		*(v16hu_u *)(dst + i * 2) =
+			(v16hu)__builtin_ia32_permdi256((v4di)c, 0xd8);
+	}
+
+	if (i < width)
+		ms912x_xrgb_to_uyvy_scalar(dst + i * 2, src + i, width - i);
+}
+
+const struct ms912x_convert_kernel ms912x_convert_avx2 = {
+	.name = "avx2",
+	.needs_fpu = true,
+	.available = ms912x_avx2_available,
+	.line = ms912x_avx2_line,
+};
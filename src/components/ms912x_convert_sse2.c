@@ -0,0 +1,92 @@
+#include <linux/types.h>
+
+#include "ms912x_convert.h"
+
+/*
+ * Built with -msse2 (see Makefile), only ever called between
+ * kernel_fpu_begin() and kernel_fpu_end().
+ */
+
+typedef int v4si __attribute__((vector_size(16)));
+typedef unsigned int v4su __attribute__((vector_size(16)));
+typedef unsigned long long v2du __attribute__((vector_size(16)));
+typedef unsigned short v8hu __attribute__((vector_size(16)));
+
+typedef unsigned int v4su_u
+	__attribute__((vector_size(16), aligned(1), may_alias));
+typedef unsigned short v8hu_u
+	__attribute__((vector_size(16), aligned(1), may_alias));
+
+/* Narrow two vectors of 32-bit values <= 0xffff into one vector of 16-bit */
+static inline v8hu ms912x_sse2_pack(v4su lo, v4su hi)
+{
+	return (v8hu)__builtin_ia32_packssdw128((v4si)lo, (v4si)hi);
+}
+
+/*
+ * Average of each pixel pair in the even 32-bit lane, zero in the odd lane,
+ * matching (c1 + c2) >> 1 in the scalar reference.
+ */
+static inline v4su ms912x_sse2_pair_avg(v4su c)
+{
+	v2du q = (v2du)c;
+
+	return (v4su)(((q & 0xffffffffULL) + (q >> 32)) >> 1);
+}
+
+/**
+ * ms912x_sse2_line - Convert a line to UYVY 8 pixels at a time
+ * @dst: destination, 2 bytes per pixel
+ * @line: source pixels in XRGB8888
+ * @width: number of pixels, must be even
+ *
+ * All arithmetic is done on unsigned 16-bit lanes. The biases keep every
+ * intermediate result of the U and V sums in [0, 0xffff], so the modular
+ * lane arithmetic needs neither sign handling nor clamping.
+ */
+static void ms912x_sse2_line(u8 *dst, const void *line, unsigned int width)
+{
+	const u32 *src = line;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= width; i += 8) {
+		v4su a = *(const v4su_u *)(src + i);
+		v4su b = *(const v4su_u *)(src + i + 4);
+		v4su ra = (a >> 16) & 0xff, rb = (b >> 16) & 0xff;
+		v4su ga = (a >> 8) & 0xff, gb = (b >> 8) & 0xff;
+		v4su ba = a & 0xff, bb = b & 0xff;
+		v8hu r, g, bl, rc, gc, bc, y, u, v, c;
+
+		r = ms912x_sse2_pack(ra, rb);
+		g = ms912x_sse2_pack(ga, gb);
+		bl = ms912x_sse2_pack(ba, bb);
+		y = (r * MS912X_Y_R + g * MS912X_Y_G + bl * MS912X_Y_B +
+		     MS912X_Y_BIAS) >> 8;
+
+		/* Pair averages land in the even 16-bit lanes */
+		rc = ms912x_sse2_pack(ms912x_sse2_pair_avg(ra),
+				      ms912x_sse2_pair_avg(rb));
+		gc = ms912x_sse2_pack(ms912x_sse2_pair_avg(ga),
+				      ms912x_sse2_pair_avg(gb));
+		bc = ms912x_sse2_pack(ms912x_sse2_pair_avg(ba),
+				      ms912x_sse2_pair_avg(bb));
+		u = (bc * MS912X_U_B - rc * -MS912X_U_R - gc * -MS912X_U_G +
+		     MS912X_UV_BIAS) >> 8;
+		v = (rc * MS912X_V_R - gc * -MS912X_V_G - bc * -MS912X_V_B +
+		     MS912X_UV_BIAS) >> 8;
+
+		/* U V U V ... in the chroma lanes, Y in the high bytes */
+		c = (v8hu)(((v4su)u & 0xffff) | ((v4su)v << 16));
+		*(v8hu_u *)(dst + i * 2) = c | (y << 8);
+	}
+
+	if (i < width)
+		ms912x_xrgb_to_uyvy_scalar(dst + i * 2, src + i, width - i);
+}
+
+const struct ms912x_convert_kernel ms912x_convert_sse2 = {
+	.name = "sse2",
+	.needs_fpu = true,
+	.available = ms912x_sse2_available,
+	.line = ms912x_sse2_line,
+};
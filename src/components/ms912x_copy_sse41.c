@@ -0,0 +1,58 @@
+#include <linux/io.h>
+#include <linux/minmax.h>
+#include <linux/types.h>
+
+#include "ms912x_convert.h"
+
+/*
+ * Built with -msse4.1 (see Makefile), only ever called between
+ * kernel_fpu_begin() and kernel_fpu_end().
+ */
+
+typedef long long v2di __attribute__((vector_size(16)));
+
+typedef long long v2di_u
+	__attribute__((vector_size(16), aligned(1), may_alias));
+
+/**
+ * ms912x_copy_from_wc - Copy out of write-combined or I/O memory
+ * @dst: destination in system memory
+ * @src: source, e.g. an imported dma-buf in VRAM
+ * @len: number of bytes
+ *
+ * Uncached reads of such memory go out one at a time. movntdqa fetches a
+ * whole line into a streaming buffer instead, so reading it 16 bytes at a
+ * time approaches the speed of cached memory. The unaligned head and tail
+ * are copied with memcpy_fromio().
+ */
+void ms912x_copy_from_wc(void *dst, const void __iomem *src, size_t len)
+{
+	size_t head = min_t(size_t, len, -(unsigned long)src & 15);
+	u8 *d = dst;
+	u8 *s;
+
+	if (head) {
+		memcpy_fromio(d, src, head);
+		d += head;
+		len -= head;
+	}
+	s = (u8 __force *)src + head;
+
+	for (; len >= 64; len -= 64, s += 64, d += 64) {
+		v2di a = __builtin_ia32_movntdqa((v2di *)s);
+		v2di b = __builtin_ia32_movntdqa((v2di *)(s + 16));
+		v2di c = __builtin_ia32_movntdqa((v2di *)(s + 32));
+		v2di e = __builtin_ia32_movntdqa((v2di *)(s + 48));
+
+		*(v2di_u *)d = a;
+		*(v2di_u *)(d + 16) = b;
+		*(v2di_u *)(d + 32) = c;
+		*(v2di_u *)(d + 48) = e;
+	}
+
+	for (; len >= 16; len -= 16, s += 16, d += 16)
+		*(v2di_u *)d = __builtin_ia32_movntdqa((v2di *)s);
+
+	if (len)
+		memcpy_fromio(d, (const void __iomem __force *)s, len);
+}
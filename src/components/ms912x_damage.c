@@ -0,0 +1,182 @@
+#include <linux/kernel.h>
+#include <linux/minmax.h>
+
+#include "../include/ms912x.h"
+
+/*
+ * Fixed cost of one more segment, in payload bytes: the header and the
+ * trailer on the wire plus the setup the device does for every update.
+ * Two rects are sent as one when the pixels that the union adds cost less
+ * than that. The value is an estimate; it is low enough that a clock and
+ * a cursor in opposite corners stay separate.
+ */
+#define MS912X_DAMAGE_SEGMENT_COST 1024
+
+/**
+ * ms912x_damage_align - Align a damage clip to what the device can update
+ * @rect: clip in framebuffer coordinates, aligned in place
+ * @width: visible width, the smaller of framebuffer and mode
+ * @height: visible height, the smaller of framebuffer and mode
+ *
+ * Seems like hardware can only update framebuffer in multiples of 16
+ * horizontally. Resolutions that are not a multiple of 16 like 1366x768
+ * lose the last few columns.
+ *
+ * Returns false if nothing of @rect is left.
+ */
+bool ms912x_damage_align(struct drm_rect *rect, int width, int height)
+{
+	rect->x1 = ALIGN_DOWN(max(rect->x1, 0), 16);
+	rect->x2 = min(ALIGN(rect->x2, 16), ALIGN_DOWN(width, 16));
+	rect->y1 = max(rect->y1, 0);
+	rect->y2 = min(rect->y2, height);
+
+	return drm_rect_visible(rect);
+}
+
+static s64 ms912x_rect_area(const struct drm_rect *rect)
+{
+	return (s64)drm_rect_width(rect) * drm_rect_height(rect);
+}
+
+static void ms912x_rect_union(struct drm_rect *dst, const struct drm_rect *a,
+			      const struct drm_rect *b)
+{
+	dst->x1 = min(a->x1, b->x1);
+	dst->y1 = min(a->y1, b->y1);
+	dst->x2 = max(a->x2, b->x2);
+	dst->y2 = max(a->y2, b->y2);
+}
+
+/*
+ * Extra payload bytes if @a and @b are sent as their union at @cpp bytes
+ * per pixel, may be < 0
+ */
+static s64 ms912x_merge_waste(const struct drm_rect *a,
+			      const struct drm_rect *b, unsigned int cpp)
+{
+	struct drm_rect u, i = *a;
+	s64 overlap = 0;
+
+	ms912x_rect_union(&u, a, b);
+	if (drm_rect_intersect(&i, b))
+		overlap = ms912x_rect_area(&i);
+
+	return (ms912x_rect_area(&u) - ms912x_rect_area(a) -
+		ms912x_rect_area(b) + overlap) * cpp;
+}
+
+static void ms912x_damage_remove(struct ms912x_damage *damage, unsigned int i)
+{
+	damage->rects[i] = damage->rects[--damage->count];
+}
+
+/* Merge pairs until no merge pays off any more */
+static void ms912x_damage_coalesce(struct ms912x_damage *damage,
+				   unsigned int cpp)
+{
+	unsigned int i, j;
+	bool merged;
+
+	do {
+		merged = false;
+		for (i = 0; i < damage->count && !merged; i++) {
+			for (j = i + 1; j < damage->count; j++) {
+				if (ms912x_merge_waste(&damage->rects[i],
+						       &damage->rects[j], cpp) >
+				    MS912X_DAMAGE_SEGMENT_COST)
+					continue;
+
+				ms912x_rect_union(&damage->rects[i],
+						  &damage->rects[i],
+						  &damage->rects[j]);
+				ms912x_damage_remove(damage, j);
+				merged = true;
+				break;
+			}
+		}
+	} while (merged);
+}
+
+/**
+ * ms912x_damage_add - Add an aligned rect to a damage set
+ * @damage: damage set
+ * @rect: rect aligned with ms912x_damage_align()
+ * @cpp: bytes per pixel on the wire
+ *
+ * Rects are merged whenever sending their union is cheaper than one more
+ * segment. When the set is full, @rect goes into the rect where it wastes
+ * the least.
+ */
+void ms912x_damage_add(struct ms912x_damage *damage,
+		       const struct drm_rect *rect, unsigned int cpp)
+{
+	unsigned int i, best = 0;
+	s64 waste, best_waste = S64_MAX;
+
+	if (!drm_rect_visible(rect))
+		return;
+
+	if (damage->count < MS912X_MAX_DAMAGE_RECTS) {
+		damage->rects[damage->count++] = *rect;
+	} else {
+		for (i = 0; i < damage->count; i++) {
+			waste = ms912x_merge_waste(&damage->rects[i], rect,
+						   cpp);
+			if (waste < best_waste) {
+				best_waste = waste;
+				best = i;
+			}
+		}
+		ms912x_rect_union(&damage->rects[best], &damage->rects[best],
+				  rect);
+	}
+
+	ms912x_damage_coalesce(damage, cpp);
+}
+
+void ms912x_damage_merge(struct ms912x_damage *dst,
+			 const struct ms912x_damage *src, unsigned int cpp)
+{
+	unsigned int i;
+
+	for (i = 0; i < src->count; i++)
+		ms912x_damage_add(dst, &src->rects[i], cpp);
+}
+
+/**
+ * ms912x_damage_flatten - Replace a damage set by its bounding box
+ * @damage: damage set
+ *
+ * Used when overlapping segments would not fit into a request buffer.
+ */
+void ms912x_damage_flatten(struct ms912x_damage *damage)
+{
+	while (damage->count > 1) {
+		ms912x_rect_union(&damage->rects[0], &damage->rects[0],
+				  &damage->rects[damage->count - 1]);
+		damage->count--;
+	}
+}
+
+/*
+ * Wire size of one segment: header, payload of @cpp bytes per pixel and
+ * trailer
+ */
+size_t ms912x_damage_segment_len(const struct drm_rect *rect, unsigned int cpp)
+{
+	return sizeof(struct ms912x_frame_update_header) +
+	       (size_t)drm_rect_width(rect) * cpp * drm_rect_height(rect) +
+	       MS912X_END_OF_BUFFER_LEN;
+}
+
+size_t ms912x_damage_len(const struct ms912x_damage *damage, unsigned int cpp)
+{
+	size_t len = 0;
+	unsigned int i;
+
+	for (i = 0; i < damage->count; i++)
+		len += ms912x_damage_segment_len(&damage->rects[i], cpp);
+
+	return len;
+}
@@ -0,0 +1,42 @@
+#ifndef MS912X_DAMAGE_H
+#define MS912X_DAMAGE_H
+
+#include <linux/types.h>
+
+#include <drm/drm_rect.h>
+
+/* Segments per frame update, each one is header + payload + trailer */
+#define MS912X_MAX_DAMAGE_RECTS 8
+
+/**
+ * struct ms912x_damage - Damage of a frame update as a small set of rects
+ * @count: number of rects in use
+ * @rects: rects aligned with ms912x_damage_align(), one wire segment each
+ */
+struct ms912x_damage {
+	unsigned int count;
+	struct drm_rect rects[MS912X_MAX_DAMAGE_RECTS];
+};
+
+static inline void ms912x_damage_init(struct ms912x_damage *damage)
+{
+	damage->count = 0;
+}
+
+static inline bool ms912x_damage_empty(const struct ms912x_damage *damage)
+{
+	return !damage->count;
+}
+
+bool ms912x_damage_align(struct drm_rect *rect, int width, int height);
+void ms912x_damage_add(struct ms912x_damage *damage,
+		       const struct drm_rect *rect, unsigned int cpp);
+void ms912x_damage_merge(struct ms912x_damage *dst,
+			 const struct ms912x_damage *src, unsigned int cpp);
+void ms912x_damage_flatten(struct ms912x_damage *damage);
+size_t ms912x_damage_segment_len(const struct drm_rect *rect,
+				 unsigned int cpp);
+size_t ms912x_damage_len(const struct ms912x_damage *damage,
+			 unsigned int cpp);
+
+#endif // MS912X_DAMAGE_H
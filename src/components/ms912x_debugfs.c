@@ -0,0 +1,241 @@
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/module.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+
+#include <drm/drm_debugfs.h>
+#include <drm/drm_file.h>
+
+#include "../include/ms912x.h"
+
+static int ms912x_debugfs_ring_show(struct seq_file *m, void *data)
+{
+	struct drm_debugfs_entry *entry = m->private;
+	struct ms912x_device *ms912x = to_ms912x(entry->dev);
+	const struct ms912x_ring_stats *stats = &ms912x->ring_stats;
+
+	seq_printf(m, "size: %u\n", ms912x->ring_size);
+	seq_printf(m, "queued: %lld\n", atomic64_read(&stats->queued));
+	seq_printf(m, "replaced: %lld\n", atomic64_read(&stats->replaced));
+	seq_printf(m, "deferred: %lld\n", atomic64_read(&stats->deferred));
+
+	return 0;
+}
+
+static int ms912x_debugfs_tiles_show(struct seq_file *m, void *data)
+{
+	struct drm_debugfs_entry *entry = m->private;
+	struct ms912x_device *ms912x = to_ms912x(entry->dev);
+	const struct ms912x_tile_stats *stats = &ms912x->tile_stats;
+
+	seq_printf(m, "enabled: %s\n", READ_ONCE(ms912x->tile_hash) ? "yes" : "no");
+	seq_printf(m, "tiles_checked: %lld\n",
+		   atomic64_read(&stats->tiles_checked));
+	seq_printf(m, "tiles_unchanged: %lld\n",
+		   atomic64_read(&stats->tiles_unchanged));
+	seq_printf(m, "bytes_checked: %lld\n",
+		   atomic64_read(&stats->bytes_checked));
+	seq_printf(m, "bytes_saved: %lld\n", atomic64_read(&stats->bytes_saved));
+
+	return 0;
+}
+
+static int ms912x_debugfs_governor_show(struct seq_file *m, void *data)
+{
+	struct drm_debugfs_entry *entry = m->private;
+	struct ms912x_device *ms912x = to_ms912x(entry->dev);
+	struct ms912x_governor gov;
+	s64 period = ktime_to_ns(READ_ONCE(ms912x->frame_period));
+
+	ms912x_governor_snapshot(ms912x, &gov);
+
+	seq_printf(m, "enabled: %s\n", ms912x_governor_enabled() ? "yes" : "no");
+	seq_printf(m, "rate_kbps: %llu\n", gov.rate / 1000);
+	seq_printf(m, "frame_cost_us: %llu\n", gov.cost_ns / NSEC_PER_USEC);
+	seq_printf(m, "frame_period_us: %lld\n", period / NSEC_PER_USEC);
+	seq_printf(m, "divider: %u\n", gov.divider);
+	seq_printf(m, "update_hz: %lld\n",
+		   period > 0 ? NSEC_PER_SEC / (period * gov.divider) : 0);
+	seq_printf(m, "samples: %llu\n", gov.samples);
+	seq_printf(m, "throttled: %llu\n", gov.throttled);
+	seq_printf(m, "restored: %llu\n", gov.restored);
+
+	return 0;
+}
+
+static int ms912x_debugfs_edid_show(struct seq_file *m, void *data)
+{
+	struct drm_debugfs_entry *entry = m->private;
+	struct ms912x_device *ms912x = to_ms912x(entry->dev);
+
+	mutex_lock(&ms912x->edid_lock);
+	seq_printf(m, "connected: %s\n", ms912x->edid_connected ? "yes" : "no");
+	seq_printf(m, "ready: %s\n", ms912x->edid_ready ? "yes" : "no");
+	seq_printf(m, "cached: %s\n", ms912x->edid ? "yes" : "no");
+	seq_printf(m, "reads: %llu\n", ms912x->edid_reads);
+	mutex_unlock(&ms912x->edid_lock);
+
+	return 0;
+}
+
+/* Runs the diagnostics now if the deferred run has not happened yet */
+static int ms912x_debugfs_diagnostics_show(struct seq_file *m, void *data)
+{
+	struct drm_debugfs_entry *entry = m->private;
+	struct ms912x_device *ms912x = to_ms912x(entry->dev);
+	const struct ms912x_diag *diag = &ms912x->diag;
+	bool pending;
+
+	mutex_lock(&ms912x->diag_lock);
+	pending = !diag->runs;
+	mutex_unlock(&ms912x->diag_lock);
+
+	if (pending)
+		ms912x_run_diagnostics(ms912x);
+
+	mutex_lock(&ms912x->diag_lock);
+	seq_printf(m, "runs: %u\n", diag->runs);
+	seq_printf(m, "status: %d\n", diag->status);
+	seq_printf(m, "duration_us: %lld\n", diag->duration_us);
+	seq_printf(m, "reg30: 0x%02x\n", diag->reg30);
+	seq_printf(m, "reg33: 0x%02x\n", diag->reg33);
+	seq_printf(m, "reg_c620: 0x%02x\n", diag->reg_c620);
+	seq_printf(m, "edid_header: %8phN (%s)\n", diag->edid_header,
+		   diag->edid_header_valid ? "valid" : "invalid");
+	mutex_unlock(&ms912x->diag_lock);
+
+	return 0;
+}
+
+/**
+ * ms912x_debugfs_init - Register the driver's debugfs files
+ * @ms912x: device, not registered yet
+ *
+ * The files show up in the DRM minor's debugfs directory once the device
+ * is registered and go away with it.
+ */
+void ms912x_debugfs_init(struct ms912x_device *ms912x)
+{
+	drm_debugfs_add_file(&ms912x->drm, "ms912x_ring",
+			     ms912x_debugfs_ring_show, NULL);
+	drm_debugfs_add_file(&ms912x->drm, "ms912x_tiles",
+			     ms912x_debugfs_tiles_show, NULL);
+	drm_debugfs_add_file(&ms912x->drm, "ms912x_governor",
+			     ms912x_debugfs_governor_show, NULL);
+	drm_debugfs_add_file(&ms912x->drm, "ms912x_edid",
+			     ms912x_debugfs_edid_show, NULL);
+	drm_debugfs_add_file(&ms912x->drm, "ms912x_diagnostics",
+			     ms912x_debugfs_diagnostics_show, NULL);
+}
+
+static const char *const ms912x_stat_names[MS912X_STAT_COUNT] = {
+	[MS912X_STAT_COMMITS] = "commits",
+	[MS912X_STAT_COALESCED] = "coalesced",
+	[MS912X_STAT_PACED] = "paced",
+	[MS912X_STAT_SUBMITTED] = "submitted",
+	[MS912X_STAT_SENT] = "sent",
+	[MS912X_STAT_DROP_TIMEOUT] = "dropped_timeout",
+	[MS912X_STAT_DROP_UNPLUG] = "dropped_unplug",
+	[MS912X_STAT_DROP_DEV_ENTER] = "dropped_dev_enter",
+	[MS912X_STAT_DROP_ERROR] = "dropped_error",
+	[MS912X_STAT_BYTES] = "bytes",
+	[MS912X_STAT_PIXELS] = "pixels",
+};
+
+static const char *const ms912x_hist_names[MS912X_HIST_COUNT] = {
+	[MS912X_HIST_CONVERT] = "convert",
+	[MS912X_HIST_USB] = "usb",
+	[MS912X_HIST_LATENCY] = "latency",
+};
+
+static int ms912x_stats_counters_show(struct seq_file *m, void *data)
+{
+	struct ms912x_device *ms912x = m->private;
+	struct ms912x_stats *sum;
+	unsigned int i;
+
+	/* Too large for the stack */
+	sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+
+	ms912x_stats_snapshot(ms912x, sum);
+	for (i = 0; i < MS912X_STAT_COUNT; i++)
+		seq_printf(m, "%s: %llu\n", ms912x_stat_names[i],
+			   sum->counters[i]);
+
+	kfree(sum);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ms912x_stats_counters);
+
+/* One line per non-empty bucket: upper bound in us and count */
+static int ms912x_stats_histograms_show(struct seq_file *m, void *data)
+{
+	struct ms912x_device *ms912x = m->private;
+	struct ms912x_stats *sum;
+	unsigned int i, j;
+
+	sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+
+	ms912x_stats_snapshot(ms912x, sum);
+	for (i = 0; i < MS912X_HIST_COUNT; i++) {
+		seq_printf(m, "%s_us:\n", ms912x_hist_names[i]);
+		for (j = 0; j < MS912X_HIST_BUCKETS; j++) {
+			if (!sum->hist[i][j])
+				continue;
+			if (j == MS912X_HIST_BUCKETS - 1)
+				seq_printf(m, "  >=%lu: %llu\n", BIT(j - 1),
+					   sum->hist[i][j]);
+			else
+				seq_printf(m, "  <%lu: %llu\n", BIT(j),
+					   sum->hist[i][j]);
+		}
+	}
+
+	kfree(sum);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ms912x_stats_histograms);
+
+/* Writing anything to reset clears the counters and histograms */
+static ssize_t ms912x_stats_reset_write(struct file *file,
+					const char __user *buf, size_t len,
+					loff_t *ppos)
+{
+	struct ms912x_device *ms912x = file->private_data;
+
+	ms912x_stats_reset(ms912x);
+
+	return len;
+}
+
+static const struct file_operations ms912x_stats_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = ms912x_stats_reset_write,
+	.llseek = noop_llseek,
+};
+
+/**
+ * ms912x_debugfs_minor_init - Create the ms912x_stats directory
+ * @minor: DRM minor, its debugfs directory is the device's
+ *
+ * Called by the DRM core while registering the device.
+ */
+void ms912x_debugfs_minor_init(struct drm_minor *minor)
+{
+	struct ms912x_device *ms912x = to_ms912x(minor->dev);
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("ms912x_stats", minor->debugfs_root);
+	debugfs_create_file("counters", 0444, dir, ms912x,
+			    &ms912x_stats_counters_fops);
+	debugfs_create_file("histograms", 0444, dir, ms912x,
+			    &ms912x_stats_histograms_fops);
+	debugfs_create_file("reset", 0200, dir, ms912x,
+			    &ms912x_stats_reset_fops);
+}
@@ -1,10 +1,37 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/usb.h>
+#include <linux/workqueue.h>
 #include <drm/drm_print.h>
 
 #include "../include/ms912x.h"
 
+/*
+ * Diagnostics are not needed to bring the display up, so they run from a
+ * delayed work once the first modeset had a chance to go out, or on the
+ * first read of the ms912x_diagnostics debugfs file. The results are kept
+ * in ms912x->diag for that file.
+ */
+
+/* Let fbdev's first modeset have the control endpoint first */
+#define MS912X_DIAG_DELAY_MS 2000
+
+static bool diagnostics = true;
+module_param(diagnostics, bool, 0644);
+MODULE_PARM_DESC(diagnostics,
+		 "Run the register and EDID diagnostics in the background after probe (default: true)");
+
+/* Status registers 0x30 and 0x33 in one round trip */
+static int ms912x_diag_read_status(struct ms912x_device *ms912x, u8 *reg30,
+				   u8 *reg33)
+{
+	ms912x_reg_batch_begin(ms912x);
+	ms912x_reg_batch_read(ms912x, 0x30, reg30);
+	ms912x_reg_batch_read(ms912x, 0x33, reg33);
+
+	return ms912x_reg_batch_run(ms912x);
+}
+
 /**
  * @brief Проверяет подключение устройства
  * 
@@ -21,17 +48,20 @@ int ms912x_diag_check_connection(struct ms912x_device *ms912x)
 	pr_info("ms912x: [%s] running connection diagnostic\n", ms912x->device_name);
 	
 	// Проверяем базовые регистры устройства
-	int reg30 = ms912x_read_byte(ms912x, 0x30);
-	int reg33 = ms912x_read_byte(ms912x, 0x33);
-	
-	if (reg30 < 0 || reg33 < 0) {
-		pr_err("ms912x: [%s] failed to read status registers: reg30=%d, reg33=%d\n", 
-		       ms912x->device_name, reg30, reg33);
+	u8 reg30, reg33;
+	int ret;
+
+	ret = ms912x_diag_read_status(ms912x, &reg30, &reg33);
+	if (ret < 0) {
+		pr_err("ms912x: [%s] failed to read status registers: %d\n",
+		       ms912x->device_name, ret);
 		return -EIO;
 	}
 	
 	pr_info("ms912x: [%s] connection diagnostic passed: reg30=0x%02x, reg33=0x%02x\n",
 	        ms912x->device_name, reg30, reg33);
+	ms912x->diag.reg30 = reg30;
+	ms912x->diag.reg33 = reg33;
 	
 	// Добавляем дополнительную диагностику при успешной проверке подключения
 	pr_info("ms912x: [%s] device connection verified: registers indicate device is present\n",
@@ -65,6 +95,7 @@ int ms912x_diag_check_memory(struct ms912x_device *ms912x)
 	
 	pr_info("ms912x: [%s] memory diagnostic passed: reg_c620=0x%02x\n",
 	        ms912x->device_name, reg_c620);
+	ms912x->diag.reg_c620 = reg_c620;
 	
 	// Добавляем дополнительную диагностику при успешной проверке памяти
 	pr_info("ms912x: [%s] memory access verified: extended register c620 is accessible\n",
@@ -99,7 +130,10 @@ int ms912x_diag_check_edid(struct ms912x_device *ms912x)
 	
 	// Проверяем заголовок EDID (должен начинаться с 0x00 0xFF 0xFF 0xFF 0xFF 0xFF 0xFF 0x00)
 	const u8 expected_header[8] = {0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00};
-	if (memcmp(edid_header, expected_header, 8) != 0) {
+	memcpy(ms912x->diag.edid_header, edid_header, sizeof(edid_header));
+	ms912x->diag.edid_header_valid =
+		!memcmp(edid_header, expected_header, 8);
+	if (!ms912x->diag.edid_header_valid) {
 		pr_warn("ms912x: [%s] unexpected EDID header: %*ph\n", 
 		        ms912x->device_name, 8, edid_header);
 		// Это не обязательно ошибка, некоторые устройства могут иметь другой формат
@@ -116,19 +150,9 @@ int ms912x_diag_check_edid(struct ms912x_device *ms912x)
 	return 0;
 }
 
-/**
- * @brief Выполняет полную диагностику устройства
- * 
- * @param ms912x Устройство для диагностики
- * @return 0 при успехе, отрицательное значение при ошибке
- */
-int ms912x_run_diagnostics(struct ms912x_device *ms912x)
+/* All checks in order, called with diag_lock held */
+static int ms912x_diag_run_checks(struct ms912x_device *ms912x)
 {
-	if (!ms912x) {
-		pr_err("ms912x: invalid device pointer in run_diagnostics\n");
-		return -EINVAL;
-	}
-	
 	pr_info("ms912x: [%s] starting full diagnostics\n", ms912x->device_name);
 	
 	int ret;
@@ -158,10 +182,75 @@ int ms912x_run_diagnostics(struct ms912x_device *ms912x)
 	
 	
 	// Добавляем дополнительную информацию о состоянии устройства после диагностики
-	int reg30 = ms912x_read_byte(ms912x, 0x30);
-	int reg33 = ms912x_read_byte(ms912x, 0x33);
+	u8 reg30 = 0, reg33 = 0;
+
+	ms912x_diag_read_status(ms912x, &reg30, &reg33);
 	pr_info("ms912x: [%s] device status after diagnostics: reg30=0x%02x, reg33=0x%02x\n",
-	        ms912x->device_name, reg30 >= 0 ? reg30 : 0, reg33 >= 0 ? reg33 : 0);
+	        ms912x->device_name, reg30, reg33);
 	
 	return 0;
 }
+
+/**
+ * @brief Выполняет полную диагностику устройства
+ * 
+ * Результаты сохраняются в ms912x->diag для debugfs.
+ *
+ * @param ms912x Устройство для диагностики
+ * @return 0 при успехе, отрицательное значение при ошибке
+ */
+int ms912x_run_diagnostics(struct ms912x_device *ms912x)
+{
+	if (!ms912x) {
+		pr_err("ms912x: invalid device pointer in run_diagnostics\n");
+		return -EINVAL;
+	}
+
+	ktime_t start = ktime_get();
+	int ret;
+
+	mutex_lock(&ms912x->diag_lock);
+	ret = ms912x_diag_run_checks(ms912x);
+	ms912x->diag.status = ret;
+	ms912x->diag.duration_us = ktime_us_delta(ktime_get(), start);
+	ms912x->diag.runs++;
+	mutex_unlock(&ms912x->diag_lock);
+
+	if (ret < 0)
+		pr_warn("ms912x: [%s] diagnostics failed: %d\n",
+			ms912x->device_name, ret);
+	else
+		pr_info("ms912x: [%s] diagnostics passed\n",
+			ms912x->device_name);
+
+	return ret;
+}
+
+static void ms912x_diag_work(struct work_struct *work)
+{
+	struct ms912x_device *ms912x =
+		container_of(to_delayed_work(work), struct ms912x_device,
+			     diag_work);
+
+	ms912x_run_diagnostics(ms912x);
+}
+
+void ms912x_diag_init(struct ms912x_device *ms912x)
+{
+	mutex_init(&ms912x->diag_lock);
+	INIT_DELAYED_WORK(&ms912x->diag_work, ms912x_diag_work);
+}
+
+void ms912x_diag_schedule(struct ms912x_device *ms912x)
+{
+	if (!READ_ONCE(diagnostics))
+		return;
+
+	queue_delayed_work(system_long_wq, &ms912x->diag_work,
+			   msecs_to_jiffies(MS912X_DIAG_DELAY_MS));
+}
+
+void ms912x_diag_cancel(struct ms912x_device *ms912x)
+{
+	cancel_delayed_work_sync(&ms912x->diag_work);
+}
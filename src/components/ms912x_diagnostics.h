@@ -38,6 +38,27 @@ int ms912x_diag_check_edid(struct ms912x_device *ms912x);
  */
 int ms912x_run_diagnostics(struct ms912x_device *ms912x);
 
+/**
+ * @brief Инициализирует отложенную диагностику
+ *
+ * @param ms912x Устройство
+ */
+void ms912x_diag_init(struct ms912x_device *ms912x);
+
+/**
+ * @brief Запускает диагностику в фоне, после того как устройство заработало
+ *
+ * @param ms912x Устройство
+ */
+void ms912x_diag_schedule(struct ms912x_device *ms912x);
+
+/**
+ * @brief Отменяет отложенную диагностику и ждёт её завершения
+ *
+ * @param ms912x Устройство
+ */
+void ms912x_diag_cancel(struct ms912x_device *ms912x);
+
 /**
  * @brief Получает информацию о состоянии устройства
  *
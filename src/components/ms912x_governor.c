@@ -0,0 +1,171 @@
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/spinlock.h>
+
+#include "../include/ms912x.h"
+
+/*
+ * Bandwidth governor
+ *
+ * Every frame that made it to the device is a throughput sample: its
+ * bytes over the time from the first chunk going on the wire to the last
+ * URB completing. From the smoothed rate the governor estimates how long
+ * the next frame will occupy the link. When that exceeds the pacer's
+ * frame interval the interval is doubled, up to MS912X_GOV_MAX_DIVIDER
+ * frame periods, so damage piles up in the pacer and goes out as fewer,
+ * merged frames instead of the ring dropping whatever it can not fit.
+ * Once frames have fit into half the interval for a while it is halved
+ * again.
+ *
+ * The wire format is part of the mode programmed into the device, so
+ * switching to a cheaper encoding would take a modeset; lowering the
+ * update rate is the only lever that does not blank the screen.
+ */
+
+/* Slowest update rate, in frame periods */
+#define MS912X_GOV_MAX_DIVIDER 8
+/* Frames that must fit into half the interval before it is halved */
+#define MS912X_GOV_CALM_FRAMES 16
+/* Smaller frames are dominated by latency, not bandwidth */
+#define MS912X_GOV_MIN_SAMPLE (64 * 1024)
+/* Weight of a new sample in the rate average, as a shift */
+#define MS912X_GOV_EWMA_SHIFT 3
+
+static bool governor = true;
+module_param(governor, bool, 0644);
+MODULE_PARM_DESC(governor,
+		 "Lower the update rate while frames take longer than a frame period on the wire (default: true)");
+
+void ms912x_governor_init(struct ms912x_device *ms912x)
+{
+	struct ms912x_governor *gov = &ms912x->governor;
+
+	spin_lock_init(&gov->lock);
+	gov->divider = 1;
+}
+
+/**
+ * ms912x_governor_reset - Start a new mode at the full update rate
+ * @ms912x: device
+ *
+ * The measured rate is kept, it belongs to the link and not to the mode.
+ */
+void ms912x_governor_reset(struct ms912x_device *ms912x)
+{
+	struct ms912x_governor *gov = &ms912x->governor;
+	unsigned long flags;
+
+	spin_lock_irqsave(&gov->lock, flags);
+	gov->divider = 1;
+	gov->calm = 0;
+	gov->cost_ns = 0;
+	spin_unlock_irqrestore(&gov->lock, flags);
+}
+
+/**
+ * ms912x_governor_sample - Account a frame that reached the device
+ * @ms912x: device
+ * @len: bytes sent
+ * @elapsed: time from the first submission to the last completion
+ *
+ * Called from URB completion context.
+ */
+void ms912x_governor_sample(struct ms912x_device *ms912x, size_t len,
+			    ktime_t elapsed)
+{
+	struct ms912x_governor *gov = &ms912x->governor;
+	s64 ns = ktime_to_ns(elapsed);
+	unsigned long flags;
+	u64 rate;
+
+	if (len < MS912X_GOV_MIN_SAMPLE || ns <= 0)
+		return;
+
+	rate = div64_u64((u64)len * NSEC_PER_SEC, ns);
+
+	spin_lock_irqsave(&gov->lock, flags);
+	if (gov->rate)
+		gov->rate += (rate >> MS912X_GOV_EWMA_SHIFT) -
+			     (gov->rate >> MS912X_GOV_EWMA_SHIFT);
+	else
+		gov->rate = rate;
+	gov->samples++;
+	spin_unlock_irqrestore(&gov->lock, flags);
+}
+
+/**
+ * ms912x_governor_update - Decide when the frame after this one may go out
+ * @ms912x: device
+ * @len: bytes of the frame just queued
+ *
+ * Returns the number of frame periods until the pacer sends the next
+ * frame. Called from flush_work with flush_lock held.
+ */
+unsigned int ms912x_governor_update(struct ms912x_device *ms912x, size_t len)
+{
+	struct ms912x_governor *gov = &ms912x->governor;
+	u64 period = ktime_to_ns(ms912x->frame_period);
+	unsigned int divider;
+	unsigned long flags;
+	u64 cost;
+
+	spin_lock_irqsave(&gov->lock, flags);
+	if (!READ_ONCE(governor) || !gov->rate) {
+		gov->divider = 1;
+		gov->calm = 0;
+		goto out;
+	}
+
+	cost = div64_u64((u64)len * NSEC_PER_SEC, gov->rate);
+	gov->cost_ns = cost;
+
+	if (cost > period * gov->divider) {
+		gov->calm = 0;
+		if (gov->divider < MS912X_GOV_MAX_DIVIDER) {
+			gov->divider *= 2;
+			gov->throttled++;
+		}
+	} else if (gov->divider > 1 && cost <= period * gov->divider / 2) {
+		if (++gov->calm >= MS912X_GOV_CALM_FRAMES) {
+			gov->divider /= 2;
+			gov->calm = 0;
+			gov->restored++;
+		}
+	} else {
+		gov->calm = 0;
+	}
+
+out:
+	divider = gov->divider;
+	spin_unlock_irqrestore(&gov->lock, flags);
+
+	return divider;
+}
+
+/**
+ * ms912x_governor_snapshot - Copy the governor state for reporting
+ * @ms912x: device
+ * @snap: filled in, its lock is not initialised
+ */
+void ms912x_governor_snapshot(struct ms912x_device *ms912x,
+			      struct ms912x_governor *snap)
+{
+	struct ms912x_governor *gov = &ms912x->governor;
+	unsigned long flags;
+
+	spin_lock_irqsave(&gov->lock, flags);
+	snap->rate = gov->rate;
+	snap->cost_ns = gov->cost_ns;
+	snap->divider = gov->divider;
+	snap->calm = gov->calm;
+	snap->samples = gov->samples;
+	snap->throttled = gov->throttled;
+	snap->restored = gov->restored;
+	spin_unlock_irqrestore(&gov->lock, flags);
+}
+
+bool ms912x_governor_enabled(void)
+{
+	return READ_ONCE(governor);
+}
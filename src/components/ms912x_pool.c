@@ -0,0 +1,421 @@
+#include <linux/device.h>
+#include <linux/dma-mapping.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/shrinker.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+
+#include "../include/ms912x.h"
+
+/*
+ * Transfer buffers
+ *
+ * A transfer buffer is built from physically contiguous chunks of up to
+ * MS912X_MAX_TRANSFER_LENGTH bytes, allocated on the host controller's
+ * NUMA node within its DMA mask. Every chunk is DMA mapped once when the
+ * buffer is allocated, so a bulk URB never covers more than one chunk and
+ * is submitted with its DMA address; nothing is mapped per frame. The
+ * chunks are vmapped into one range for the converter.
+ *
+ * Module wide pool of idle transfer buffers
+ *
+ * Disabled pipes hand their transfer buffers back here instead of keeping
+ * them until disconnect, and the next modeset of the same size on an
+ * adapter behind the same host controller takes them back without
+ * allocating or mapping anything. Idle buffers are given back to the
+ * system by a shrinker under memory pressure.
+ *
+ * Idle buffers stay mapped for their controller and hold a reference on
+ * it, so the pool counts the adapters bound behind every controller and
+ * frees its buffers when the last one goes away, e.g. with a dock's host
+ * controller. Buffers of an unplugged adapter are never pooled.
+ */
+
+#define MS912X_XFER_CHUNK_ORDER get_order(MS912X_MAX_TRANSFER_LENGTH)
+
+static LIST_HEAD(ms912x_pool_list);
+static DEFINE_SPINLOCK(ms912x_pool_lock);
+/* Pages held by the pool */
+static unsigned long ms912x_pool_pages;
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0))
+static struct shrinker *ms912x_pool_shrinker;
+#else
+static struct shrinker ms912x_pool_shrinker_static;
+static struct shrinker *ms912x_pool_shrinker = &ms912x_pool_shrinker_static;
+#endif
+
+/* Adapters bound behind each controller that has pooled buffers */
+struct ms912x_pool_user {
+	struct list_head entry;
+	struct device *dev;
+	unsigned int count;
+};
+
+static LIST_HEAD(ms912x_pool_users);
+static DEFINE_MUTEX(ms912x_pool_users_lock);
+
+static unsigned long ms912x_xfer_buf_pages(const struct ms912x_xfer_buf *buf)
+{
+	return (unsigned long)buf->nr_chunks << (buf->chunk_shift - PAGE_SHIFT);
+}
+
+static void ms912x_xfer_buf_free(struct ms912x_xfer_buf *buf)
+{
+	unsigned int i;
+
+	if (buf->vaddr)
+		vunmap(buf->vaddr);
+
+	for (i = 0; buf->chunks && i < buf->nr_chunks; i++) {
+		if (!buf->chunks[i])
+			continue;
+		if (buf->dma && !dma_mapping_error(buf->dev, buf->dma[i]))
+			dma_unmap_page(buf->dev, buf->dma[i],
+				       1UL << buf->chunk_shift, DMA_TO_DEVICE);
+		__free_pages(buf->chunks[i], buf->chunk_shift - PAGE_SHIFT);
+	}
+
+	kfree(buf->dma);
+	kfree(buf->chunks);
+	put_device(buf->dev);
+	kfree(buf);
+}
+
+static int ms912x_xfer_buf_alloc_chunks(struct ms912x_xfer_buf *buf,
+					unsigned int order, gfp_t gfp,
+					int node)
+{
+	unsigned int i;
+
+	buf->chunk_shift = PAGE_SHIFT + order;
+	buf->nr_chunks = DIV_ROUND_UP(buf->len, 1UL << buf->chunk_shift);
+	buf->chunks = kcalloc_node(buf->nr_chunks, sizeof(*buf->chunks),
+				   GFP_KERNEL, node);
+	if (!buf->chunks)
+		return -ENOMEM;
+
+	/* Higher orders are only worth a try, order 0 has to work */
+	if (order)
+		gfp |= __GFP_NORETRY | __GFP_NOWARN;
+
+	for (i = 0; i < buf->nr_chunks; i++) {
+		buf->chunks[i] = alloc_pages_node(node, gfp, order);
+		if (!buf->chunks[i])
+			goto err_free;
+	}
+
+	return 0;
+
+err_free:
+	while (i--)
+		__free_pages(buf->chunks[i], order);
+	kfree(buf->chunks);
+	buf->chunks = NULL;
+	return -ENOMEM;
+}
+
+static int ms912x_xfer_buf_vmap(struct ms912x_xfer_buf *buf)
+{
+	unsigned int per_chunk = 1U << (buf->chunk_shift - PAGE_SHIFT);
+	unsigned long nr_pages = ms912x_xfer_buf_pages(buf);
+	struct page **pages;
+	unsigned int i, j;
+
+	pages = kvmalloc_array(nr_pages, sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+
+	for (i = 0; i < buf->nr_chunks; i++)
+		for (j = 0; j < per_chunk; j++)
+			pages[i * per_chunk + j] = buf->chunks[i] + j;
+
+	buf->vaddr = vmap(pages, nr_pages, VM_MAP, PAGE_KERNEL);
+	kvfree(pages);
+
+	return buf->vaddr ? 0 : -ENOMEM;
+}
+
+static int ms912x_xfer_buf_map(struct ms912x_xfer_buf *buf)
+{
+	unsigned int i;
+
+	buf->dma = kcalloc(buf->nr_chunks, sizeof(*buf->dma), GFP_KERNEL);
+	if (!buf->dma)
+		return -ENOMEM;
+
+	for (i = 0; i < buf->nr_chunks; i++)
+		buf->dma[i] = DMA_MAPPING_ERROR;
+
+	for (i = 0; i < buf->nr_chunks; i++) {
+		buf->dma[i] = dma_map_page(buf->dev, buf->chunks[i], 0,
+					   1UL << buf->chunk_shift,
+					   DMA_TO_DEVICE);
+		if (dma_mapping_error(buf->dev, buf->dma[i]))
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/*
+ * Allocate a transfer buffer for the controller @dev, DMA mapped unless
+ * the controller does not do DMA (@map false).
+ */
+static struct ms912x_xfer_buf *ms912x_xfer_buf_alloc(struct device *dev,
+						     bool map, size_t len)
+{
+	int node = dev_to_node(dev);
+	struct ms912x_xfer_buf *buf;
+	gfp_t gfp = GFP_KERNEL;
+	int order;
+
+	/* Stay below the controller's DMA mask instead of bouncing */
+	if (map && dma_get_mask(dev) <= DMA_BIT_MASK(32))
+		gfp |= GFP_DMA32;
+
+	buf = kzalloc_node(sizeof(*buf), GFP_KERNEL, node);
+	if (!buf)
+		return NULL;
+
+	buf->dev = get_device(dev);
+	buf->len = len;
+
+	for (order = MS912X_XFER_CHUNK_ORDER; order >= 0; order--) {
+		if (!ms912x_xfer_buf_alloc_chunks(buf, order, gfp, node))
+			break;
+	}
+	if (order < 0)
+		goto err_free;
+
+	if (ms912x_xfer_buf_vmap(buf))
+		goto err_free;
+
+	if (map && ms912x_xfer_buf_map(buf))
+		goto err_free;
+
+	return buf;
+
+err_free:
+	ms912x_xfer_buf_free(buf);
+	return NULL;
+}
+
+/**
+ * ms912x_xfer_buf_sync - Hand a range written by the CPU to the controller
+ * @buf: transfer buffer
+ * @offset: start of the range
+ * @len: length of the range, must not cross a chunk boundary
+ */
+void ms912x_xfer_buf_sync(struct ms912x_xfer_buf *buf, size_t offset,
+			  size_t len)
+{
+	if (!buf->dma)
+		return;
+
+	dma_sync_single_for_device(buf->dev, ms912x_xfer_buf_dma(buf, offset),
+				   len, DMA_TO_DEVICE);
+}
+
+/**
+ * ms912x_pool_get - Get a transfer buffer
+ * @dev: DMA device of the host controller, usb_bus.sysdev
+ * @map: controller does DMA, map the buffer for it
+ * @len: size, a multiple of PAGE_SIZE
+ *
+ * Returns an idle buffer of exactly @len bytes for @dev from the pool, or
+ * a new one. NULL if out of memory.
+ */
+struct ms912x_xfer_buf *ms912x_pool_get(struct device *dev, bool map,
+					size_t len)
+{
+	struct ms912x_xfer_buf *buf, *found = NULL;
+
+	spin_lock(&ms912x_pool_lock);
+	list_for_each_entry(buf, &ms912x_pool_list, entry) {
+		if (buf->dev == dev && !!buf->dma == map && buf->len == len) {
+			found = buf;
+			list_del(&buf->entry);
+			ms912x_pool_pages -= ms912x_xfer_buf_pages(buf);
+			break;
+		}
+	}
+	spin_unlock(&ms912x_pool_lock);
+
+	if (!found)
+		return ms912x_xfer_buf_alloc(dev, map, len);
+
+	return found;
+}
+
+/**
+ * ms912x_pool_put - Return a transfer buffer to the pool
+ * @buf: buffer from ms912x_pool_get(), may be NULL
+ */
+void ms912x_pool_put(struct ms912x_xfer_buf *buf)
+{
+	if (!buf)
+		return;
+
+	/* Most recently used first, so the shrinker frees cold ones */
+	spin_lock(&ms912x_pool_lock);
+	list_add(&buf->entry, &ms912x_pool_list);
+	ms912x_pool_pages += ms912x_xfer_buf_pages(buf);
+	spin_unlock(&ms912x_pool_lock);
+}
+
+static unsigned long ms912x_pool_count(struct shrinker *shrinker,
+				       struct shrink_control *sc)
+{
+	unsigned long pages = READ_ONCE(ms912x_pool_pages);
+
+	return pages ? pages : SHRINK_EMPTY;
+}
+
+static unsigned long ms912x_pool_scan(struct shrinker *shrinker,
+				      struct shrink_control *sc)
+{
+	struct ms912x_xfer_buf *buf;
+	unsigned long freed = 0;
+
+	while (freed < sc->nr_to_scan) {
+		spin_lock(&ms912x_pool_lock);
+		buf = NULL;
+		if (!list_empty(&ms912x_pool_list)) {
+			buf = list_last_entry(&ms912x_pool_list,
+					      struct ms912x_xfer_buf, entry);
+			list_del(&buf->entry);
+			ms912x_pool_pages -= ms912x_xfer_buf_pages(buf);
+		}
+		spin_unlock(&ms912x_pool_lock);
+
+		if (!buf)
+			break;
+
+		freed += ms912x_xfer_buf_pages(buf);
+		ms912x_xfer_buf_free(buf);
+	}
+
+	return freed ? freed : SHRINK_STOP;
+}
+
+/* Free the idle buffers of @dev, or all of them if @dev is NULL */
+static void ms912x_pool_purge(struct device *dev)
+{
+	struct ms912x_xfer_buf *buf, *tmp;
+	LIST_HEAD(list);
+
+	spin_lock(&ms912x_pool_lock);
+	list_for_each_entry_safe(buf, tmp, &ms912x_pool_list, entry) {
+		if (dev && buf->dev != dev)
+			continue;
+		list_move(&buf->entry, &list);
+		ms912x_pool_pages -= ms912x_xfer_buf_pages(buf);
+	}
+	spin_unlock(&ms912x_pool_lock);
+
+	list_for_each_entry_safe(buf, tmp, &list, entry)
+		ms912x_xfer_buf_free(buf);
+}
+
+static void ms912x_pool_detach(void *data)
+{
+	struct device *dev = data;
+	struct ms912x_pool_user *user;
+	bool last = false;
+
+	mutex_lock(&ms912x_pool_users_lock);
+	list_for_each_entry(user, &ms912x_pool_users, entry) {
+		if (user->dev != dev)
+			continue;
+		if (!--user->count) {
+			list_del(&user->entry);
+			kfree(user);
+			last = true;
+		}
+		break;
+	}
+	/* Purged under the lock, so an adapter attaching meanwhile waits */
+	if (last)
+		ms912x_pool_purge(dev);
+	mutex_unlock(&ms912x_pool_users_lock);
+}
+
+/**
+ * ms912x_pool_attach - Count an adapter behind the controller @dev
+ * @intf: interface of the adapter, the count drops when it is unbound
+ * @dev: DMA device of the host controller, usb_bus.sysdev
+ *
+ * Once the last adapter behind @dev is unbound, the idle buffers mapped
+ * for @dev are freed.
+ */
+int ms912x_pool_attach(struct usb_interface *intf, struct device *dev)
+{
+	struct ms912x_pool_user *user;
+
+	mutex_lock(&ms912x_pool_users_lock);
+	list_for_each_entry(user, &ms912x_pool_users, entry) {
+		if (user->dev == dev) {
+			user->count++;
+			goto out;
+		}
+	}
+
+	user = kzalloc(sizeof(*user), GFP_KERNEL);
+	if (!user) {
+		mutex_unlock(&ms912x_pool_users_lock);
+		return -ENOMEM;
+	}
+	user->dev = dev;
+	user->count = 1;
+	list_add(&user->entry, &ms912x_pool_users);
+out:
+	mutex_unlock(&ms912x_pool_users_lock);
+
+	return devm_add_action_or_reset(&intf->dev, ms912x_pool_detach, dev);
+}
+
+/**
+ * ms912x_pool_free - Free a transfer buffer right away
+ * @buf: buffer from ms912x_pool_get(), may be NULL
+ *
+ * For buffers of a device that goes away, which are not worth keeping.
+ */
+void ms912x_pool_free(struct ms912x_xfer_buf *buf)
+{
+	if (buf)
+		ms912x_xfer_buf_free(buf);
+}
+
+int ms912x_pool_init(void)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0))
+	ms912x_pool_shrinker = shrinker_alloc(0, "drm-ms912x-pool");
+	if (!ms912x_pool_shrinker)
+		return -ENOMEM;
+#endif
+
+	ms912x_pool_shrinker->count_objects = ms912x_pool_count;
+	ms912x_pool_shrinker->scan_objects = ms912x_pool_scan;
+	ms912x_pool_shrinker->seeks = DEFAULT_SEEKS;
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0))
+	shrinker_register(ms912x_pool_shrinker);
+
+	return 0;
+#else
+	return register_shrinker(ms912x_pool_shrinker, "drm-ms912x-pool");
+#endif
+}
+
+void ms912x_pool_exit(void)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0))
+	shrinker_free(ms912x_pool_shrinker);
+#else
+	unregister_shrinker(ms912x_pool_shrinker);
+#endif
+	ms912x_pool_purge(NULL);
+}
@@ -1,116 +1,463 @@
+#include <linux/dma-mapping.h>
+#include <linux/moduleparam.h>
 #include <uapi/linux/hid.h>
+
+#include <drm/drm_managed.h>
+
 #include "../include/ms912x.h"
 
-int ms912x_read_byte(struct ms912x_device *ms912x, u16 address)
+/*
+ * Register access
+ *
+ * Registers are read and written through HID SET_REPORT/GET_REPORT on the
+ * control endpoint. Every transfer uses one of MS912X_REG_BATCH_MAX
+ * preallocated URBs with its own DMA-safe slot, and a batch queues up to
+ * that many transfers and submits them back to back: the host controller
+ * runs them in order and the caller waits once for the last completion
+ * instead of once per transfer. A read is a SET_REPORT naming the address
+ * followed by a GET_REPORT returning the value, so it takes two transfers.
+ * The 8-byte reply echoes the request and carries the addressed byte and
+ * the MS912X_REG_BURST_LEN - 1 bytes that follow it, so one read can
+ * return up to MS912X_REG_BURST_LEN consecutive registers.
+ *
+ *	ms912x_reg_batch_begin(ms912x);
+ *	ms912x_reg_batch_write(ms912x, 0x04, data);
+ *	ms912x_reg_batch_read(ms912x, 0x30, &val);
+ *	ret = ms912x_reg_batch_run(ms912x);
+ *
+ * The first failing transfer unlinks the ones queued behind it, so a batch
+ * stops at its first error like a sequence of synchronous calls would.
+ *
+ * The last value written to each of the control registers 0x01-0x07 is
+ * kept in a shadow. ms912x_reg_batch_update() skips writes the shadow
+ * says are redundant and ms912x_power_on() skips programming a mode the
+ * device already shows. A failed batch, a power off (the device forgets
+ * its mode then) and a reset resume mark the shadowed values unknown; the
+ * values themselves stay, so the next power on can tell that it only
+ * replays the previous mode.
+ */
+
+#define MS912X_REG_LEN 8
+#define MS912X_REG_TIMEOUT_MS USB_CTRL_SET_TIMEOUT
+
+static bool burst_reads = true;
+module_param(burst_reads, bool, 0444);
+MODULE_PARM_DESC(burst_reads,
+		 "Use all bytes of a register read reply, 5 registers per read (default: true)");
+
+static void ms912x_reg_complete(struct urb *urb)
 {
-	// Добавляем проверку на NULL
-	if (!ms912x) {
-		pr_err("ms912x: invalid device pointer in read_byte\n");
-		return -EINVAL;
+	struct ms912x_device *ms912x = urb->context;
+	struct ms912x_regs *regs = &ms912x->regs;
+	int status = urb->status;
+	unsigned int i;
+
+	i = ((u8 *)urb->transfer_buffer - regs->buf) / regs->slot_len;
+
+	/* A reply too short for the value asked for is no reply */
+	if (!status && usb_pipein(urb->pipe) &&
+	    urb->actual_length <
+		    offsetof(struct ms912x_request, data) + regs->val_lens[i])
+		status = -EIO;
+
+	if (status && regs->optional[i] && status != -ECONNRESET &&
+	    status != -ENOENT) {
+		pr_debug("ms912x: [%s] optional register transfer failed: %d\n",
+			 ms912x->device_name, status);
+		status = 0;
 	}
-	
-	int ret;
-	struct usb_interface *intf = ms912x->intf;
-	if (!intf) {
-		pr_err("ms912x: invalid interface pointer in read_byte\n");
-		return -EINVAL;
+
+	/* Keep the first error, the unlinked ones report -ECONNRESET */
+	if (status && !cmpxchg(&regs->status, 0, status))
+		usb_unlink_anchored_urbs(&regs->anchor);
+
+	if (atomic_dec_and_test(&regs->pending))
+		complete(&regs->done);
+}
+
+static void ms912x_regs_release(struct drm_device *drm, void *data)
+{
+	struct ms912x_regs *regs = data;
+	unsigned int i;
+
+	for (i = 0; i < MS912X_REG_BATCH_MAX; i++)
+		usb_free_urb(regs->urbs[i]);
+}
+
+/**
+ * ms912x_regs_init - Allocate the URBs and buffers for register access
+ * @ms912x: device
+ *
+ * Must be called before the first register access. Everything is freed
+ * with the DRM device.
+ */
+int ms912x_regs_init(struct ms912x_device *ms912x)
+{
+	struct ms912x_regs *regs = &ms912x->regs;
+	unsigned int i;
+
+	mutex_init(&regs->lock);
+	init_usb_anchor(&regs->anchor);
+	regs->burst = burst_reads;
+	init_completion(&regs->done);
+
+	/* IN slots must not share a cache line with anything else */
+	regs->slot_len = ALIGN(MS912X_REG_LEN, dma_get_cache_alignment());
+	regs->buf = drmm_kzalloc(&ms912x->drm,
+				 regs->slot_len * MS912X_REG_BATCH_MAX,
+				 GFP_KERNEL);
+	regs->setup = drmm_kcalloc(&ms912x->drm, MS912X_REG_BATCH_MAX,
+				   sizeof(*regs->setup), GFP_KERNEL);
+	if (!regs->buf || !regs->setup)
+		return -ENOMEM;
+
+	for (i = 0; i < MS912X_REG_BATCH_MAX; i++) {
+		regs->urbs[i] = usb_alloc_urb(0, GFP_KERNEL);
+		if (!regs->urbs[i]) {
+			ms912x_regs_release(&ms912x->drm, regs);
+			return -ENOMEM;
+		}
 	}
-	
-	struct usb_device *usb_dev = interface_to_usbdev(intf);
-	if (!usb_dev) {
-		pr_err("ms912x: invalid usb device pointer in read_byte\n");
-		return -EINVAL;
+
+	return drmm_add_action_or_reset(&ms912x->drm, ms912x_regs_release,
+					regs);
+}
+
+/**
+ * ms912x_reg_batch_begin - Start queueing register transfers
+ * @ms912x: device
+ *
+ * Takes the register lock until ms912x_reg_batch_run().
+ */
+void ms912x_reg_batch_begin(struct ms912x_device *ms912x)
+{
+	struct ms912x_regs *regs = &ms912x->regs;
+
+	mutex_lock(&regs->lock);
+	regs->count = 0;
+	regs->status = 0;
+}
+
+/*
+ * Queue one transfer of MS912X_REG_LEN bytes, returns its slot or NULL.
+ * An @optional transfer that fails is only logged.
+ */
+static void *ms912x_reg_batch_add(struct ms912x_device *ms912x, bool in,
+				  u8 *val, unsigned int len, bool optional)
+{
+	struct ms912x_regs *regs = &ms912x->regs;
+	struct usb_device *usb_dev = interface_to_usbdev(ms912x->intf);
+	struct usb_ctrlrequest *setup;
+	unsigned int pipe;
+	void *buf;
+
+	lockdep_assert_held(&regs->lock);
+
+	if (regs->count == MS912X_REG_BATCH_MAX) {
+		pr_err("ms912x: [%s] register batch overflow\n",
+		       ms912x->device_name);
+		regs->status = -ENOSPC;
+		return NULL;
 	}
-	
-	pr_debug("ms912x: reading byte from address 0x%04x\n", address);
-	
-	struct ms912x_request *request = kzalloc(8, GFP_KERNEL);
-	if (!request) {
-		pr_err("ms912x: failed to allocate request in read_byte\n");
-		return -ENOMEM;
+
+	setup = &regs->setup[regs->count];
+	buf = regs->buf + regs->count * regs->slot_len;
+
+	setup->bRequestType = (in ? USB_DIR_IN : USB_DIR_OUT) | USB_TYPE_CLASS |
+			      USB_RECIP_INTERFACE;
+	setup->bRequest = in ? HID_REQ_GET_REPORT : HID_REQ_SET_REPORT;
+	setup->wValue = cpu_to_le16(0x0300);
+	setup->wIndex = 0;
+	setup->wLength = cpu_to_le16(MS912X_REG_LEN);
+
+	pipe = in ? usb_rcvctrlpipe(usb_dev, 0) : usb_sndctrlpipe(usb_dev, 0);
+	usb_fill_control_urb(regs->urbs[regs->count], usb_dev, pipe,
+			     (u8 *)setup, buf, MS912X_REG_LEN,
+			     ms912x_reg_complete, ms912x);
+	regs->vals[regs->count] = val;
+	regs->val_lens[regs->count] = len;
+	regs->optional[regs->count] = optional;
+	regs->count++;
+
+	memset(buf, 0, MS912X_REG_LEN);
+	return buf;
+}
+
+/**
+ * ms912x_reg_batch_write - Queue a write of 6 bytes
+ * @ms912x: device
+ * @address: register
+ * @data: 6 bytes, copied
+ */
+void ms912x_reg_batch_write(struct ms912x_device *ms912x, u8 address,
+			    const void *data)
+{
+	struct ms912x_write_request *request;
+
+	request = ms912x_reg_batch_add(ms912x, false, NULL, 0, false);
+	if (!request)
+		return;
+
+	request->type = 0xa6;
+	request->addr = address;
+	memcpy(request->data, data, sizeof(request->data));
+}
+
+/**
+ * ms912x_reg_batch_read_burst - Queue a read of consecutive registers
+ * @ms912x: device
+ * @address: first register
+ * @buf: where ms912x_reg_batch_run() stores the values, may be NULL for
+ *       reads the device expects but whose values do not matter
+ * @len: number of registers, at most MS912X_REG_BURST_LEN
+ *
+ * A read with a NULL @buf is best effort, its failure does not fail the
+ * batch.
+ */
+void ms912x_reg_batch_read_burst(struct ms912x_device *ms912x, u16 address,
+				 u8 *buf, unsigned int len)
+{
+	struct ms912x_request *request;
+
+	if (WARN_ON(!len || len > MS912X_REG_BURST_LEN)) {
+		ms912x->regs.status = -EINVAL;
+		return;
 	}
 
+	request = ms912x_reg_batch_add(ms912x, false, NULL, 0, !buf);
+	if (!request)
+		return;
+
 	request->type = 0xb5;
 	request->addr = cpu_to_be16(address);
 
-	ret = usb_control_msg(usb_dev, usb_sndctrlpipe(usb_dev, 0),
-			HID_REQ_SET_REPORT,
-			USB_DIR_OUT | USB_TYPE_CLASS | USB_RECIP_INTERFACE,
-			0x0300, 0, request, 8, USB_CTRL_SET_TIMEOUT);
-	if (ret < 0) {
-		pr_err("ms912x: failed to send read request to address 0x%04x: %d\n", address, ret);
-		kfree(request);
-		return ret;
+	ms912x_reg_batch_add(ms912x, true, buf, len, !buf);
+}
+
+/**
+ * ms912x_reg_batch_read - Queue a read of one register
+ * @ms912x: device
+ * @address: register
+ * @val: see ms912x_reg_batch_read_burst()
+ */
+void ms912x_reg_batch_read(struct ms912x_device *ms912x, u16 address, u8 *val)
+{
+	ms912x_reg_batch_read_burst(ms912x, address, val, 1);
+}
+
+/* Record write @i of a batch that went through in the shadow */
+static void ms912x_reg_shadow_store(struct ms912x_regs *regs, unsigned int i)
+{
+	const struct ms912x_write_request *request =
+		(const void *)(regs->buf + i * regs->slot_len);
+
+	if (usb_pipein(regs->urbs[i]->pipe) || request->type != 0xa6 ||
+	    request->addr > MS912X_REG_SHADOW_MAX)
+		return;
+
+	memcpy(regs->shadow[request->addr], request->data,
+	       sizeof(request->data));
+	regs->shadow_valid |= BIT(request->addr);
+}
+
+static bool ms912x_reg_shadow_equal(struct ms912x_regs *regs, u8 address,
+				    const void *data)
+{
+	return address <= MS912X_REG_SHADOW_MAX &&
+	       !memcmp(regs->shadow[address], data, sizeof(regs->shadow[0]));
+}
+
+static bool ms912x_reg_shadow_valid(struct ms912x_regs *regs, u8 address)
+{
+	return address <= MS912X_REG_SHADOW_MAX &&
+	       (regs->shadow_valid & BIT(address));
+}
+
+/**
+ * ms912x_reg_batch_update - Queue a write unless the register holds @data
+ * @ms912x: device
+ * @address: register
+ * @data: 6 bytes, copied
+ */
+void ms912x_reg_batch_update(struct ms912x_device *ms912x, u8 address,
+			     const void *data)
+{
+	struct ms912x_regs *regs = &ms912x->regs;
+
+	lockdep_assert_held(&regs->lock);
+
+	if (ms912x_reg_shadow_valid(regs, address) &&
+	    ms912x_reg_shadow_equal(regs, address, data)) {
+		pr_debug("ms912x: [%s] register 0x%02x unchanged, write skipped\n",
+			 ms912x->device_name, address);
+		return;
 	}
 
-	ret = usb_control_msg(usb_dev, usb_rcvctrlpipe(usb_dev, 0),
-			      HID_REQ_GET_REPORT,
-			      USB_DIR_IN | USB_TYPE_CLASS | USB_RECIP_INTERFACE,
-			      0x0300, 0, request, 8, USB_CTRL_GET_TIMEOUT);
-	if (ret < 0) {
-		pr_err("ms912x: failed to receive read response from address 0x%04x: %d\n", address, ret);
-		kfree(request);
-		return ret;
+	ms912x_reg_batch_write(ms912x, address, data);
+}
+
+/**
+ * ms912x_regs_invalidate - Forget what the control registers hold
+ * @ms912x: device
+ *
+ * For when the device may have lost its state, e.g. on a reset resume.
+ */
+void ms912x_regs_invalidate(struct ms912x_device *ms912x)
+{
+	mutex_lock(&ms912x->regs.lock);
+	ms912x->regs.shadow_valid = 0;
+	mutex_unlock(&ms912x->regs.lock);
+}
+
+/**
+ * ms912x_reg_batch_run - Submit the queued transfers and wait for them
+ * @ms912x: device
+ *
+ * Stores the values of the queued reads and drops the register lock.
+ * Returns 0 or the error of the first transfer that failed, in which case
+ * the values of the reads are undefined.
+ */
+int ms912x_reg_batch_run(struct ms912x_device *ms912x)
+{
+	struct ms912x_regs *regs = &ms912x->regs;
+	const struct ms912x_request *reply;
+	unsigned int i, submitted = 0;
+	int ret;
+
+	if (regs->status)
+		goto out;
+
+	reinit_completion(&regs->done);
+	/* Reference of the submitter, so done can not fire half way */
+	atomic_set(&regs->pending, 1);
+
+	for (i = 0; i < regs->count && !READ_ONCE(regs->status); i++) {
+		usb_anchor_urb(regs->urbs[i], &regs->anchor);
+		atomic_inc(&regs->pending);
+		ret = usb_submit_urb(regs->urbs[i], GFP_KERNEL);
+		if (ret) {
+			usb_unanchor_urb(regs->urbs[i]);
+			atomic_dec(&regs->pending);
+			cmpxchg(&regs->status, 0, ret);
+			usb_unlink_anchored_urbs(&regs->anchor);
+			break;
+		}
+		submitted++;
 	}
 
-	ret = (ret > 0) ? request->data[0] : (ret == 0) ? -EIO : ret;
-	
-	pr_debug("ms912x: read byte from address 0x%04x: 0x%02x\n", address, ret);
-	
-	// Добавляем дополнительную диагностику при ошибках чтения
-	if (ret < 0) {
-		pr_err("ms912x: [%s] failed to read byte from address 0x%04x: %d\n",
-		       ms912x->device_name, address, ret);
+	if (!atomic_dec_and_test(&regs->pending) &&
+	    !wait_for_completion_timeout(&regs->done,
+					 msecs_to_jiffies(MS912X_REG_TIMEOUT_MS))) {
+		cmpxchg(&regs->status, 0, -ETIMEDOUT);
+		usb_kill_anchored_urbs(&regs->anchor);
+		/* Unlinked before the timeout, but maybe not given back yet */
+		wait_for_completion(&regs->done);
+	}
+
+	if (regs->status)
+		goto out;
+
+	for (i = 0; i < regs->count; i++) {
+		ms912x_reg_shadow_store(regs, i);
+		if (!regs->vals[i])
+			continue;
+		reply = (const void *)(regs->buf + i * regs->slot_len);
+		memcpy(regs->vals[i], reply->data, regs->val_lens[i]);
 	}
 
-	kfree(request);
+out:
+	ret = regs->status;
+	if (ret) {
+		pr_err("ms912x: [%s] register batch failed after %u of %u transfers: %d\n",
+		       ms912x->device_name, submitted, regs->count, ret);
+		/* Some of the writes may have reached the device */
+		regs->shadow_valid = 0;
+	} else {
+		pr_debug("ms912x: [%s] register batch of %u transfers done\n",
+			 ms912x->device_name, regs->count);
+	}
+	mutex_unlock(&regs->lock);
+
 	return ret;
 }
 
-static inline int ms912x_write_6_bytes(struct ms912x_device *ms912x,
-				       u16 address, void *data)
+int ms912x_read_byte(struct ms912x_device *ms912x, u16 address)
 {
-	// Добавляем проверки на NULL
+	u8 val;
+	int ret;
+
+	// Добавляем проверку на NULL
 	if (!ms912x) {
-		pr_err("ms912x: invalid device pointer in write_6_bytes\n");
-		return -EINVAL;
-	}
-	
-	if (!data) {
-		pr_err("ms912x: invalid data pointer in write_6_bytes\n");
+		pr_err("ms912x: invalid device pointer in read_byte\n");
 		return -EINVAL;
 	}
-	
-	struct usb_interface *intf = ms912x->intf;
-	if (!intf) {
-		pr_err("ms912x: invalid interface pointer in write_6_bytes\n");
-		return -EINVAL;
+
+	pr_debug("ms912x: reading byte from address 0x%04x\n", address);
+
+	ms912x_reg_batch_begin(ms912x);
+	ms912x_reg_batch_read(ms912x, address, &val);
+	ret = ms912x_reg_batch_run(ms912x);
+	if (ret < 0) {
+		pr_err("ms912x: [%s] failed to read byte from address 0x%04x: %d\n",
+		       ms912x->device_name, address, ret);
+		return ret;
 	}
-	
-	struct usb_device *usb_dev = interface_to_usbdev(intf);
-	if (!usb_dev) {
-		pr_err("ms912x: invalid usb device pointer in write_6_bytes\n");
-		return -EINVAL;
+
+	pr_debug("ms912x: read byte from address 0x%04x: 0x%02x\n", address, val);
+
+	return val;
+}
+
+/**
+ * ms912x_read_bytes - Read a range of consecutive registers
+ * @ms912x: device
+ * @address: first register
+ * @buf: values
+ * @len: number of registers
+ *
+ * Takes one round trip per MS912X_REG_BATCH_MAX / 2 reads, each of which
+ * returns MS912X_REG_BURST_LEN registers unless burst reads are off for
+ * the device.
+ */
+int ms912x_read_bytes(struct ms912x_device *ms912x, u16 address, u8 *buf,
+		      size_t len)
+{
+	unsigned int burst = READ_ONCE(ms912x->regs.burst) ?
+				     MS912X_REG_BURST_LEN : 1;
+	size_t step = burst * (MS912X_REG_BATCH_MAX / 2);
+	size_t i, j, n;
+	int ret;
+
+	for (i = 0; i < len; i += step) {
+		n = min(len - i, step);
+
+		ms912x_reg_batch_begin(ms912x);
+		for (j = 0; j < n; j += burst)
+			ms912x_reg_batch_read_burst(ms912x, address + i + j,
+						    buf + i + j,
+						    min_t(size_t, n - j, burst));
+		ret = ms912x_reg_batch_run(ms912x);
+		if (ret < 0) {
+			pr_err("ms912x: [%s] failed to read registers at 0x%04zx: %d\n",
+			       ms912x->device_name, address + i, ret);
+			return ret;
+		}
 	}
-	
+
+	return 0;
+}
+
+static inline int ms912x_write_6_bytes(struct ms912x_device *ms912x,
+				       u16 address, void *data)
+{
+	int ret;
+
 	pr_debug("ms912x: writing 6 bytes to address 0x%04x\n", address);
-	
-	struct ms912x_write_request *request =
-		kzalloc(sizeof(struct ms912x_write_request), GFP_KERNEL);
-	if (!request) {
-		pr_err("ms912x: failed to allocate write request\n");
-		return -ENOMEM;
-	}
 
-	request->type = 0xa6;
-	request->addr = address;
-	memcpy(request->data, data, 6);
+	ms912x_reg_batch_begin(ms912x);
+	ms912x_reg_batch_update(ms912x, address, data);
+	ret = ms912x_reg_batch_run(ms912x);
 
-	int ret = usb_control_msg(
-		usb_dev, usb_sndctrlpipe(usb_dev, 0), HID_REQ_SET_REPORT,
-		USB_DIR_OUT | USB_TYPE_CLASS | USB_RECIP_INTERFACE, 0x0300, 0,
-		request, sizeof(*request), USB_CTRL_SET_TIMEOUT);
-	
 	if (ret < 0) {
 		pr_err("ms912x: [%s] failed to write 6 bytes to address 0x%04x: %d\n",
 		       ms912x->device_name, address, ret);
@@ -119,11 +466,92 @@ static inline int ms912x_write_6_bytes(struct ms912x_device *ms912x,
 		         ms912x->device_name, address);
 	}
 
-	kfree(request);
 	return ret;
 }
 
-int ms912x_power_on(struct ms912x_device *ms912x)
+/* Registers that only hold their value while the output is powered */
+#define MS912X_REG_MODE_MASK (BIT(0x01) | BIT(0x02) | BIT(0x04) | BIT(0x05))
+
+/*
+ * Queue the mode programming sequence, as captured from the vendor driver.
+ *
+ * Nothing is queued if the shadow shows @mode already live. The status
+ * reads and the configuration mode write are only needed once after the
+ * device lost its state, so a plain power cycle replays the rest.
+ */
+static void ms912x_reg_batch_resolution(struct ms912x_device *ms912x,
+					const struct ms912x_mode *mode)
+{
+	struct ms912x_regs *regs = &ms912x->regs;
+	struct ms912x_resolution_request resolution_request = {
+		.width = cpu_to_be16(mode->width),
+		.height = cpu_to_be16(mode->height),
+		.pixel_format = cpu_to_be16(mode->pix_fmt)
+	};
+	struct ms912x_mode_request mode_request = {
+		.mode = cpu_to_be16(mode->mode),
+		.width = cpu_to_be16(mode->width),
+		.height = cpu_to_be16(mode->height)
+	};
+	const u8 enabled[6] = { 1 };
+	const u8 config[6] = { 0x03 };
+	u8 data[6] = { 0 };
+
+	if ((regs->shadow_valid & MS912X_REG_MODE_MASK) ==
+		    MS912X_REG_MODE_MASK &&
+	    ms912x_reg_shadow_equal(regs, 0x01, &resolution_request) &&
+	    ms912x_reg_shadow_equal(regs, 0x02, &mode_request) &&
+	    ms912x_reg_shadow_equal(regs, 0x04, enabled) &&
+	    ms912x_reg_shadow_equal(regs, 0x05, enabled)) {
+		pr_debug("ms912x: [%s] mode %dx%d already programmed\n",
+			 ms912x->device_name, mode->width, mode->height);
+		return;
+	}
+
+	pr_debug("ms912x: step 1 - reset display\n");
+	ms912x_reg_batch_write(ms912x, 0x04, data);
+
+	if (ms912x_reg_shadow_valid(regs, 0x03) &&
+	    ms912x_reg_shadow_equal(regs, 0x03, config)) {
+		pr_debug("ms912x: [%s] replaying mode, steps 2 and 3 skipped\n",
+			 ms912x->device_name);
+	} else {
+		/*
+		 * The values do not matter, the firmware seems to expect the
+		 * reads. Best effort, like in the vendor sequence: a failed
+		 * read does not abort the modeset.
+		 */
+		pr_debug("ms912x: step 2 - read status registers\n");
+		ms912x_reg_batch_read(ms912x, 0x30, NULL);
+		ms912x_reg_batch_read(ms912x, 0x33, NULL);
+		ms912x_reg_batch_read(ms912x, 0xc620, NULL);
+
+		pr_debug("ms912x: step 3 - set configuration mode\n");
+		ms912x_reg_batch_write(ms912x, 0x03, config);
+	}
+
+	pr_debug("ms912x: step 4 - set resolution\n");
+	ms912x_reg_batch_write(ms912x, 0x01, &resolution_request);
+
+	pr_debug("ms912x: step 5 - set mode\n");
+	ms912x_reg_batch_write(ms912x, 0x02, &mode_request);
+
+	pr_debug("ms912x: step 6 - enable display\n");
+	data[0] = 1;
+	ms912x_reg_batch_write(ms912x, 0x04, data);
+
+	pr_debug("ms912x: step 7 - final configuration\n");
+	/* Same data reused here */
+	ms912x_reg_batch_write(ms912x, 0x05, data);
+}
+
+/**
+ * ms912x_power_on - Power the display output on
+ * @ms912x: device
+ * @mode: mode to program in the same batch, NULL to keep the current one
+ */
+int ms912x_power_on(struct ms912x_device *ms912x,
+		    const struct ms912x_mode *mode)
 {
 	// Добавляем проверку на NULL
 	if (!ms912x) {
@@ -134,7 +562,13 @@ int ms912x_power_on(struct ms912x_device *ms912x)
 	pr_info("ms912x: [%s] powering on device\n", ms912x->device_name);
 	
 	u8 data[6] = { 0x01, 0x02 };
-	int ret = ms912x_write_6_bytes(ms912x, 0x07, data);
+	int ret;
+
+	ms912x_reg_batch_begin(ms912x);
+	ms912x_reg_batch_update(ms912x, 0x07, data);
+	if (mode)
+		ms912x_reg_batch_resolution(ms912x, mode);
+	ret = ms912x_reg_batch_run(ms912x);
 	
 	if (ret < 0) {
 		pr_err("ms912x: failed to power on device: %d\n", ret);
@@ -161,6 +595,10 @@ int ms912x_power_off(struct ms912x_device *ms912x)
 	if (ret < 0) {
 		pr_err("ms912x: failed to power off device: %d\n", ret);
 	} else {
+		/* The mode has to be programmed again after powering on */
+		mutex_lock(&ms912x->regs.lock);
+		ms912x->regs.shadow_valid &= ~MS912X_REG_MODE_MASK;
+		mutex_unlock(&ms912x->regs.lock);
 		pr_info("ms912x: device powered off successfully\n");
 	}
 	
@@ -181,75 +619,19 @@ int ms912x_set_resolution(struct ms912x_device *ms912x,
 		return -EINVAL;
 	}
 	
-	pr_info("ms912x: setting resolution %dx%d, mode 0x%04x\n",
-		mode->width, mode->height, mode->mode);
-	
 	// Добавляем дополнительную диагностику перед установкой разрешения
 	pr_info("ms912x: [%s] setting resolution: width=%d, height=%d, mode=0x%04x, pix_fmt=0x%04x\n",
 	        ms912x->device_name, mode->width, mode->height, mode->mode, mode->pix_fmt);
 	
-	u8 data[6] = { 0 };
 	int ret;
 
-	pr_debug("ms912x: step 1 - reset display\n");
-	ret = ms912x_write_6_bytes(ms912x, 0x04, data);
-	if (ret < 0) {
-		pr_err("ms912x: failed to reset display: %d\n", ret);
-		return ret;
-	}
-
-	pr_debug("ms912x: step 2 - read status registers\n");
-	ms912x_read_byte(ms912x, 0x30);
-	ms912x_read_byte(ms912x, 0x33);
-	ms912x_read_byte(ms912x, 0xc620);
-
-	pr_debug("ms912x: step 3 - set configuration mode\n");
-	data[0] = 0x03;
-	ret = ms912x_write_6_bytes(ms912x, 0x03, data);
-	if (ret < 0) {
-		pr_err("ms912x: failed to set configuration mode: %d\n", ret);
-		return ret;
-	}
-
-	pr_debug("ms912x: step 4 - set resolution\n");
-	struct ms912x_resolution_request resolution_request = {
-		.width = cpu_to_be16(mode->width),
-		.height = cpu_to_be16(mode->height),
-		.pixel_format = cpu_to_be16(mode->pix_fmt)
-	};
-	ret = ms912x_write_6_bytes(ms912x, 0x01, &resolution_request);
+	ms912x_reg_batch_begin(ms912x);
+	ms912x_reg_batch_resolution(ms912x, mode);
+	ret = ms912x_reg_batch_run(ms912x);
 	if (ret < 0) {
 		pr_err("ms912x: failed to set resolution: %d\n", ret);
 		return ret;
 	}
-
-	pr_debug("ms912x: step 5 - set mode\n");
-	struct ms912x_mode_request mode_request = {
-		.mode = cpu_to_be16(mode->mode),
-		.width = cpu_to_be16(mode->width),
-		.height = cpu_to_be16(mode->height)
-	};
-	ret = ms912x_write_6_bytes(ms912x, 0x02, &mode_request);
-	if (ret < 0) {
-		pr_err("ms912x: failed to set mode: %d\n", ret);
-		return ret;
-	}
-
-	pr_debug("ms912x: step 6 - enable display\n");
-	data[0] = 1;
-	ret = ms912x_write_6_bytes(ms912x, 0x04, data);
-	if (ret < 0) {
-		pr_err("ms912x: failed to enable display: %d\n", ret);
-		return ret;
-	}
-
-	pr_debug("ms912x: step 7 - final configuration\n");
-	/* Same data reused here */
-	ret = ms912x_write_6_bytes(ms912x, 0x05, data);
-	if (ret < 0) {
-		pr_err("ms912x: failed final configuration: %d\n", ret);
-		return ret;
-	}
 	
 	pr_info("ms912x: resolution set successfully\n");
 	return 0;
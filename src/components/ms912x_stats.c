@@ -0,0 +1,88 @@
+#include <linux/bitops.h>
+#include <linux/percpu.h>
+#include <linux/string.h>
+
+#include <drm/drm_managed.h>
+
+#include "../include/ms912x.h"
+
+/*
+ * Frame counters and latency histograms
+ *
+ * Every CPU updates its own copy with this_cpu operations, so counting
+ * takes no lock and no shared cache line from commit, flush_work, the
+ * transmit thread and URB completion alike. Readers add the copies up.
+ *
+ * A reset clears the copies one by one while they may be updated, so an
+ * increment racing with it can survive or get lost. That is fine for
+ * spotting a saturated adapter, which is what these are for.
+ */
+
+static void ms912x_stats_free(struct drm_device *drm, void *stats)
+{
+	free_percpu(stats);
+}
+
+int ms912x_stats_init(struct ms912x_device *ms912x)
+{
+	ms912x->stats = alloc_percpu(struct ms912x_stats);
+	if (!ms912x->stats)
+		return -ENOMEM;
+
+	return drmm_add_action_or_reset(&ms912x->drm, ms912x_stats_free,
+					(void __force *)ms912x->stats);
+}
+
+/**
+ * ms912x_stats_time - Account a duration in a histogram
+ * @ms912x: device
+ * @hist: histogram
+ * @elapsed: duration, negative ones are ignored
+ *
+ * Safe from any context.
+ */
+void ms912x_stats_time(struct ms912x_device *ms912x, enum ms912x_hist hist,
+		       ktime_t elapsed)
+{
+	s64 us = ktime_to_us(elapsed);
+	unsigned int bucket;
+
+	if (us < 0)
+		return;
+
+	bucket = min_t(unsigned int, fls64(us), MS912X_HIST_BUCKETS - 1);
+	this_cpu_inc(ms912x->stats->hist[hist][bucket]);
+}
+
+/**
+ * ms912x_stats_snapshot - Sum up the per-CPU copies
+ * @ms912x: device
+ * @sum: filled in
+ */
+void ms912x_stats_snapshot(struct ms912x_device *ms912x,
+			   struct ms912x_stats *sum)
+{
+	const struct ms912x_stats *stats;
+	unsigned int i, j;
+	int cpu;
+
+	memset(sum, 0, sizeof(*sum));
+
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(ms912x->stats, cpu);
+		for (i = 0; i < MS912X_STAT_COUNT; i++)
+			sum->counters[i] += READ_ONCE(stats->counters[i]);
+		for (i = 0; i < MS912X_HIST_COUNT; i++)
+			for (j = 0; j < MS912X_HIST_BUCKETS; j++)
+				sum->hist[i][j] += READ_ONCE(stats->hist[i][j]);
+	}
+}
+
+void ms912x_stats_reset(struct ms912x_device *ms912x)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(ms912x->stats, cpu), 0,
+		       sizeof(struct ms912x_stats));
+}
@@ -0,0 +1,203 @@
+#include <linux/minmax.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/version.h>
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(6, 12, 0))
+#include <asm/unaligned.h>
+#else
+#include <linux/unaligned.h>
+#endif
+
+#include <drm/drm_framebuffer.h>
+
+#include "../include/ms912x.h"
+
+/*
+ * Tile-hash change detection
+ *
+ * Compositors tend to report more damage than what changed, e.g. the
+ * whole plane on every commit or whole pages with fbdev deferred I/O. For
+ * every 16x1 pixel tile, the unit the device updates in, the driver keeps
+ * a 64-bit hash of what was last queued. Damage clips are reduced to the
+ * bands of tiles whose hash changed before they reach the damage set, so
+ * unchanged tiles are never converted or sent.
+ */
+
+#define MS912X_TILE_WIDTH 16
+
+/* Never produced by ms912x_tile_hash_tile(), forces the tile out */
+#define MS912X_TILE_HASH_STALE 0ULL
+
+static bool tile_hash;
+module_param(tile_hash, bool, 0644);
+MODULE_PARM_DESC(tile_hash,
+		 "Skip tiles that did not change since they were last sent, applies from the next modeset (default: false)");
+
+static inline u64 ms912x_tile_hash_tile(const u64 *px, unsigned int cpp)
+{
+	u64 h = 0x9e3779b97f4a7c15ULL;
+	int i;
+
+	/* 16 pixels are eight 64-bit words at 4 bytes per pixel, four at 2 */
+	for (i = 0; i < MS912X_TILE_WIDTH * cpp / 8; i++) {
+		h = (h ^ get_unaligned(&px[i])) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 32;
+	}
+
+	return h != MS912X_TILE_HASH_STALE ? h : 1;
+}
+
+static void ms912x_tile_hash_reset(struct ms912x_device *ms912x)
+{
+	memset(ms912x->tile_hash, 0,
+	       array_size(ms912x->tile_cols * ms912x->tile_rows, sizeof(u64)));
+}
+
+/**
+ * ms912x_tile_hash_alloc - Set up the tile hashes for a mode
+ * @ms912x: device
+ * @width: horizontal resolution
+ * @height: vertical resolution
+ *
+ * Does nothing unless enabled with the tile_hash parameter. On failure
+ * the device just sends all reported damage.
+ */
+void ms912x_tile_hash_alloc(struct ms912x_device *ms912x, int width,
+			    int height)
+{
+	ms912x_tile_hash_free(ms912x);
+
+	if (!READ_ONCE(tile_hash))
+		return;
+
+	ms912x->tile_hash = kvcalloc(array_size(width / MS912X_TILE_WIDTH,
+						height),
+				     sizeof(u64), GFP_KERNEL);
+	if (!ms912x->tile_hash) {
+		pr_warn("ms912x: [%s] no memory for tile hashes, sending all damage\n",
+			ms912x->device_name);
+		return;
+	}
+
+	ms912x->tile_cols = width / MS912X_TILE_WIDTH;
+	ms912x->tile_rows = height;
+	atomic_set(&ms912x->tile_hash_stale, 0);
+}
+
+void ms912x_tile_hash_free(struct ms912x_device *ms912x)
+{
+	kvfree(ms912x->tile_hash);
+	ms912x->tile_hash = NULL;
+	ms912x->tile_cols = 0;
+	ms912x->tile_rows = 0;
+}
+
+/**
+ * ms912x_tile_hash_invalidate - Forget what the device shows
+ * @ms912x: device
+ *
+ * Called when queued data may not have reached the device, e.g. after a
+ * failed bulk transfer. Safe from interrupt context; the hashes are reset
+ * by the next ms912x_tile_hash_filter().
+ */
+void ms912x_tile_hash_invalidate(struct ms912x_device *ms912x)
+{
+	atomic_set(&ms912x->tile_hash_stale, 1);
+}
+
+static void ms912x_tile_hash_add(struct ms912x_device *ms912x,
+				 struct ms912x_damage *damage,
+				 struct drm_rect *band, size_t *sent)
+{
+	if (!drm_rect_visible(band))
+		return;
+
+	ms912x_damage_add(damage, band, ms912x->cpp);
+	*sent += (size_t)drm_rect_width(band) * ms912x->cpp *
+		 drm_rect_height(band);
+	band->x2 = band->x1;
+}
+
+/**
+ * ms912x_tile_hash_filter - Add the changed part of a clip to a damage set
+ * @ms912x: device
+ * @fb: framebuffer
+ * @map: mapping of @fb
+ * @clip: clip aligned with ms912x_damage_align()
+ * @damage: damage set to add to
+ *
+ * Consecutive lines with changed tiles are added as one band spanning
+ * all of their changed tiles. Without tile hashes, for framebuffers in
+ * I/O memory or clips outside the mode, @clip is added as is.
+ * Called with flush_lock held.
+ */
+void ms912x_tile_hash_filter(struct ms912x_device *ms912x,
+			     struct drm_framebuffer *fb,
+			     const struct iosys_map *map,
+			     const struct drm_rect *clip,
+			     struct ms912x_damage *damage)
+{
+	struct ms912x_tile_stats *stats = &ms912x->tile_stats;
+	unsigned int cpp = fb->format->cpp[0];
+	size_t clip_len, sent = 0, tile_len = MS912X_TILE_WIDTH * cpp;
+	unsigned int tx, tx1, tx2, unchanged = 0;
+	struct drm_rect band = { 0 };
+	const void *line;
+	u64 h, *slot;
+	int y, lo, hi;
+
+	if (!ms912x->tile_hash || map->is_iomem ||
+	    clip->x2 > ms912x->tile_cols * MS912X_TILE_WIDTH ||
+	    clip->y2 > ms912x->tile_rows) {
+		ms912x_damage_add(damage, clip, ms912x->cpp);
+		return;
+	}
+
+	if (atomic_xchg(&ms912x->tile_hash_stale, 0))
+		ms912x_tile_hash_reset(ms912x);
+
+	tx1 = clip->x1 / MS912X_TILE_WIDTH;
+	tx2 = clip->x2 / MS912X_TILE_WIDTH;
+
+	for (y = clip->y1; y < clip->y2; y++) {
+		line = map->vaddr + y * fb->pitches[0];
+		slot = &ms912x->tile_hash[y * ms912x->tile_cols];
+		lo = INT_MAX;
+		hi = -1;
+
+		for (tx = tx1; tx < tx2; tx++) {
+			h = ms912x_tile_hash_tile(line + tx * tile_len, cpp);
+			if (slot[tx] == h) {
+				unchanged++;
+				continue;
+			}
+			slot[tx] = h;
+			lo = min_t(int, lo, tx);
+			hi = tx;
+		}
+
+		if (hi < 0) {
+			ms912x_tile_hash_add(ms912x, damage, &band, &sent);
+			continue;
+		}
+
+		if (!drm_rect_visible(&band)) {
+			drm_rect_init(&band, lo * MS912X_TILE_WIDTH, y,
+				      (hi + 1 - lo) * MS912X_TILE_WIDTH, 1);
+		} else {
+			band.x1 = min(band.x1, lo * MS912X_TILE_WIDTH);
+			band.x2 = max(band.x2, (hi + 1) * MS912X_TILE_WIDTH);
+			band.y2 = y + 1;
+		}
+	}
+	ms912x_tile_hash_add(ms912x, damage, &band, &sent);
+
+	clip_len = (size_t)drm_rect_width(clip) * ms912x->cpp *
+		   drm_rect_height(clip);
+	atomic64_add((u64)(tx2 - tx1) * drm_rect_height(clip),
+		     &stats->tiles_checked);
+	atomic64_add(unchanged, &stats->tiles_unchanged);
+	atomic64_add(clip_len, &stats->bytes_checked);
+	atomic64_add(clip_len - sent, &stats->bytes_saved);
+}
@@ -1,5 +1,14 @@
+#include <linux/completion.h>
+#include <linux/cpumask.h>
 #include <linux/dma-buf.h>
-#include <linux/vmalloc.h>
+#include <linux/irq.h>
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/stringify.h>
+#include <linux/usb/hcd.h>
+#include <linux/version.h>
+#include <linux/workqueue.h>
 
 #include <drm/drm_drv.h>
 #include <drm/drm_gem_framebuffer_helper.h>
@@ -10,13 +19,31 @@
 #define MS912X_REQUEST_TYPE 0xb5
 #define MS912X_WRITE_TYPE 0xa6
 
+static bool segment_transfers;
+module_param(segment_transfers, bool, 0644);
+MODULE_PARM_DESC(segment_transfers,
+		 "Send every damage segment of a frame as a bulk transfer of its own (default: false, one transfer per frame)");
+
+static bool tx_fifo;
+module_param(tx_fifo, bool, 0644);
+MODULE_PARM_DESC(tx_fifo,
+		 "Run the transmit threads of devices probed afterwards as SCHED_FIFO (default: false)");
+
+#define MS912X_TX_CPU_ANY (-1)
+#define MS912X_TX_CPU_NEAR (-2)
+
+static int tx_cpu = MS912X_TX_CPU_ANY;
+module_param(tx_cpu, int, 0644);
+MODULE_PARM_DESC(tx_cpu,
+		 "Pin the transmit threads of devices probed afterwards: -1 any CPU (default), -2 near the USB host controller, or a CPU number");
+
 /**
- * ms912x_request_timeout - Timer callback to cancel a USB request
+ * ms912x_request_timeout - Timer callback to cancel a stuck frame transfer
  * @t: Pointer to the timer_list structure
  *
- * This function is called when a USB request times out. It extracts the
- * associated USB request from the timer and cancels the scatter-gather
- * request using usb_sg_cancel().
+ * This function is called when a frame has not finished streaming within
+ * MS912X_REQUEST_TIMEOUT_MS. All in-flight bulk URBs of the device are
+ * unlinked; their completion handlers then release the request.
  */
 static void ms912x_request_timeout(struct timer_list *t)
 {
@@ -26,7 +53,8 @@ static void ms912x_request_timeout(struct timer_list *t)
 	if (request && request->ms912x) {
 		pr_warn("ms912x: [%s] USB request timeout, cancelling transfer\n",
 		        request->ms912x->device_name);
-		usb_sg_cancel(&request->sgr);
+		cmpxchg(&request->status, 0, -ETIMEDOUT);
+		usb_unlink_anchored_urbs(&request->ms912x->tx_anchor);
 	} else {
 		pr_warn("ms912x: USB request timeout, but request is invalid\n");
 	}
@@ -38,54 +66,439 @@ static void ms912x_request_timeout(struct timer_list *t)
 	}
 }
 
-static void ms912x_request_work(struct work_struct *work)
+/* Account a frame that left the ring, request->status says how */
+static void ms912x_request_account(struct ms912x_usb_request *request)
 {
-	struct ms912x_usb_request *request =
-		container_of(work, struct ms912x_usb_request, work);
 	struct ms912x_device *ms912x = request->ms912x;
-	struct usb_device *usbdev;
-	struct usb_sg_request *sgr = &request->sgr;
-	struct sg_table *transfer_sgt = &request->transfer_sgt;
-	
-	// Проверяем состояние устройства перед началом передачи
-	if (!ms912x || !ms912x->intf) {
-		pr_err("ms912x: invalid device state in request_work\n");
-		complete(&request->done);
+	const struct ms912x_damage *damage = &request->damage;
+	ktime_t now = ktime_get();
+	u64 pixels = 0;
+	unsigned int i;
+	int status = READ_ONCE(request->status);
+
+	if (status == -ETIMEDOUT) {
+		ms912x_stats_inc(ms912x, MS912X_STAT_DROP_TIMEOUT);
 		return;
 	}
-	
-	usbdev = interface_to_usbdev(ms912x->intf);
-	
-	// Проверяем, что устройство все еще подключено
-	struct drm_device *drm = &ms912x->drm;
-	if (drm->unplugged || !READ_ONCE(drm->registered)) {
-		pr_debug("ms912x: [%s] device unplugged, skipping USB transfer\n",
-		         ms912x->device_name);
-		complete(&request->done);
+	/* URBs killed on disconnect fail with whatever, count them as unplug */
+	if (status == -ENODEV || status == -ESHUTDOWN ||
+	    (status && ms912x->drm.unplugged)) {
+		ms912x_stats_inc(ms912x, MS912X_STAT_DROP_UNPLUG);
 		return;
 	}
-	
-	// Добавляем дополнительную диагностику перед началом передачи
-	pr_debug("ms912x: [%s] starting USB transfer: transfer_len=%zu, nents=%u\n",
-	         ms912x->device_name, request->transfer_len, transfer_sgt->nents);
-	
-	timer_setup(&request->timer, ms912x_request_timeout, 0);
-	int ret = usb_sg_init(sgr, usbdev, usb_sndbulkpipe(usbdev, 0x04), 0,
-		    transfer_sgt->sgl, transfer_sgt->nents,
-		    request->transfer_len, GFP_KERNEL);
-		    
-	// Проверяем результат инициализации
-	if (ret < 0) {
-		pr_err("ms912x: [%s] usb_sg_init failed: %d\n", ms912x->device_name, ret);
-		timer_delete_sync(&request->timer);
-		complete(&request->done);
+	if (status) {
+		ms912x_stats_inc(ms912x, MS912X_STAT_DROP_ERROR);
 		return;
 	}
-	
-	mod_timer(&request->timer, jiffies + msecs_to_jiffies(5000));
-	usb_sg_wait(sgr);
-	timer_delete_sync(&request->timer);
-	complete(&request->done);
+
+	for (i = 0; i < damage->count; i++)
+		pixels += drm_rect_width(&damage->rects[i]) *
+			  drm_rect_height(&damage->rects[i]);
+
+	ms912x_stats_inc(ms912x, MS912X_STAT_SENT);
+	ms912x_stats_add(ms912x, MS912X_STAT_BYTES, request->transfer_len);
+	ms912x_stats_add(ms912x, MS912X_STAT_PIXELS, pixels);
+	ms912x_stats_time(ms912x, MS912X_HIST_USB,
+			  ktime_sub(now, request->sent_at));
+	if (request->commit_at)
+		ms912x_stats_time(ms912x, MS912X_HIST_LATENCY,
+				  ktime_sub(now, request->commit_at));
+	ms912x_governor_sample(ms912x, request->transfer_len,
+			       ktime_sub(now, request->sent_at));
+}
+
+/*
+ * Drop one reference on the in-flight state of a request. The consumer
+ * holds one until it has submitted the last chunk, every URB holds one
+ * until it completes. The last one completes the frame's page flips and
+ * hands the slot back to the producer.
+ */
+static void ms912x_request_put(struct ms912x_usb_request *request)
+{
+	struct ms912x_device *ms912x = request->ms912x;
+
+	if (!atomic_dec_and_test(&request->pending_urbs))
+		return;
+
+	timer_delete(&request->timer);
+	ms912x_request_account(request);
+	ms912x_vblank_send_events(ms912x, &request->events);
+	atomic_set_release(&request->state, MS912X_SLOT_FREE);
+	wake_up_all(&ms912x->tx_wait);
+}
+
+static void ms912x_urb_complete(struct urb *urb)
+{
+	struct ms912x_urb *ms_urb = urb->context;
+	struct ms912x_device *ms912x = ms_urb->ms912x;
+	struct ms912x_usb_request *request = ms_urb->request;
+	unsigned long flags;
+
+	switch (urb->status) {
+	case 0:
+		break;
+	case -ENOENT:
+	case -ECONNRESET:
+	case -ESHUTDOWN:
+		/* Keep the reason the URBs were unlinked for */
+		cmpxchg(&request->status, 0, urb->status);
+		break;
+	default:
+		pr_warn_ratelimited("ms912x: [%s] bulk transfer failed: %d\n",
+				    ms912x->device_name, urb->status);
+		cmpxchg(&request->status, 0, urb->status);
+		break;
+	}
+
+	/* The device may now show something else than the tile hashes say */
+	if (urb->status)
+		ms912x_tile_hash_invalidate(ms912x);
+
+	ms_urb->request = NULL;
+	spin_lock_irqsave(&ms912x->urb_lock, flags);
+	list_add_tail(&ms_urb->entry, &ms912x->free_urbs);
+	spin_unlock_irqrestore(&ms912x->urb_lock, flags);
+	up(&ms912x->free_urb_count);
+
+	ms912x_request_put(request);
+}
+
+static struct ms912x_urb *ms912x_get_urb(struct ms912x_device *ms912x)
+{
+	struct ms912x_urb *ms_urb;
+
+	/* Back-pressure: at most MS912X_TOTAL_URBS chunks on the wire */
+	if (down_timeout(&ms912x->free_urb_count,
+			 msecs_to_jiffies(MS912X_REQUEST_TIMEOUT_MS)))
+		return NULL;
+
+	spin_lock_irq(&ms912x->urb_lock);
+	ms_urb = list_first_entry(&ms912x->free_urbs, struct ms912x_urb, entry);
+	list_del_init(&ms_urb->entry);
+	spin_unlock_irq(&ms912x->urb_lock);
+
+	return ms_urb;
+}
+
+static void ms912x_put_urb(struct ms912x_device *ms912x,
+			   struct ms912x_urb *ms_urb)
+{
+	spin_lock_irq(&ms912x->urb_lock);
+	list_add_tail(&ms_urb->entry, &ms912x->free_urbs);
+	spin_unlock_irq(&ms912x->urb_lock);
+	up(&ms912x->free_urb_count);
+}
+
+/**
+ * ms912x_submit_chunk - Submit part of a converted frame as one bulk URB
+ * @request: request whose transfer buffer holds the data
+ * @offset: start of the chunk in the transfer buffer
+ * @len: length of the chunk, at most tx_chunk_len
+ * @end_of_transfer: chunk ends a segment that goes out as its own transfer
+ *
+ * The chunk lies within one physically contiguous, already DMA mapped
+ * chunk of the transfer buffer, so the URB carries a single DMA address
+ * and the host controller neither maps nor needs scatter-gather.
+ */
+static int ms912x_submit_chunk(struct ms912x_usb_request *request,
+			       size_t offset, size_t len, bool end_of_transfer)
+{
+	struct ms912x_device *ms912x = request->ms912x;
+	struct usb_device *usbdev = interface_to_usbdev(ms912x->intf);
+	struct ms912x_xfer_buf *xfer = request->xfer;
+	struct ms912x_urb *ms_urb;
+	struct urb *urb;
+	int ret;
+
+	ms_urb = ms912x_get_urb(ms912x);
+	if (!ms_urb) {
+		pr_warn("ms912x: [%s] no free URB for frame chunk\n",
+			ms912x->device_name);
+		return -ETIMEDOUT;
+	}
+
+	urb = ms_urb->urb;
+	usb_fill_bulk_urb(urb, usbdev, usb_sndbulkpipe(usbdev, 0x04),
+			  request->transfer_buffer + offset, len,
+			  ms912x_urb_complete, ms_urb);
+	/* A short or zero length packet closes the transfer */
+	urb->transfer_flags = end_of_transfer ? URB_ZERO_PACKET : 0;
+	if (xfer->dma) {
+		/* Mapped once at allocation, only flush what the CPU wrote */
+		ms912x_xfer_buf_sync(xfer, offset, len);
+		urb->transfer_dma = ms912x_xfer_buf_dma(xfer, offset);
+		urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+	}
+
+	ms_urb->request = request;
+	atomic_inc(&request->pending_urbs);
+	usb_anchor_urb(urb, &ms912x->tx_anchor);
+	ret = usb_submit_urb(urb, GFP_KERNEL);
+	if (ret) {
+		pr_err("ms912x: [%s] usb_submit_urb failed: %d\n",
+		       ms912x->device_name, ret);
+		usb_unanchor_urb(urb);
+		ms_urb->request = NULL;
+		ms912x_put_urb(ms912x, ms_urb);
+		atomic_dec(&request->pending_urbs);
+	}
+
+	return ret;
+}
+
+static bool ms912x_device_gone(struct ms912x_device *ms912x)
+{
+	struct drm_device *drm = &ms912x->drm;
+
+	return drm->unplugged || !READ_ONCE(drm->registered);
+}
+
+/*
+ * Bytes that may be submitted next: whole chunks only, so that every URB
+ * but the last one of a transfer ends on a tx_chunk_len boundary and is
+ * a multiple of the packet size. A transfer is the whole request, or
+ * segment @seg of a split one.
+ */
+static size_t ms912x_request_ready(struct ms912x_usb_request *request,
+				   unsigned int seg, size_t sent)
+{
+	size_t ready = smp_load_acquire(&request->ready_len);
+	size_t end = request->split ? request->seg_end[seg] :
+				      request->transfer_len;
+
+	if (ready >= end)
+		return end - sent;
+
+	ready = ALIGN_DOWN(ready, request->ms912x->tx_chunk_len);
+
+	return ready > sent ? ready - sent : 0;
+}
+
+/**
+ * ms912x_stream_request - Stream a frame to the device while it is converted
+ * @request: request claimed from the ring
+ *
+ * The converter publishes its progress in ready_len band by band. Every
+ * finished chunk is submitted as its own bulk URB right away, so the first
+ * pixels are on the wire while the rest of the frame is still being
+ * converted.
+ *
+ * All segments of the request normally go out as one bulk transfer, cut
+ * into URBs at chunk boundaries only. With the segment_transfers
+ * parameter the last URB of every segment closes the transfer, so each
+ * segment reaches the device as a transfer of its own; segments then
+ * start on a packet boundary, see ms912x_request_layout().
+ */
+static void ms912x_stream_request(struct ms912x_usb_request *request)
+{
+	struct ms912x_device *ms912x = request->ms912x;
+	size_t chunk_len = ms912x_xfer_buf_chunk_len(request->xfer);
+	unsigned int seg = 0;
+	size_t sent = 0, len;
+	bool seg_done;
+	int ret = 0;
+
+	// Добавляем дополнительную диагностику перед началом передачи
+	pr_debug("ms912x: [%s] starting USB transfer: transfer_len=%zu\n",
+	         ms912x->device_name, request->transfer_len);
+
+	mod_timer(&request->timer,
+		  jiffies + msecs_to_jiffies(MS912X_REQUEST_TIMEOUT_MS));
+
+	while (!ret && sent < request->transfer_len) {
+		if (ms912x_device_gone(ms912x)) {
+			pr_debug("ms912x: [%s] device unplugged, skipping USB transfer\n",
+			         ms912x->device_name);
+			ret = -ENODEV;
+			break;
+		}
+
+		if (!wait_event_timeout(ms912x->tx_wait,
+					ms912x_request_ready(request, seg, sent) ||
+					ms912x_device_gone(ms912x),
+					msecs_to_jiffies(MS912X_REQUEST_TIMEOUT_MS))) {
+			pr_err("ms912x: [%s] frame conversion stalled at %zu/%zu\n",
+			       ms912x->device_name, sent, request->transfer_len);
+			ret = -ETIMEDOUT;
+			break;
+		}
+
+		while (!ret && (len = ms912x_request_ready(request, seg, sent))) {
+			/* URBs stay in one physically contiguous chunk */
+			len = min(len, chunk_len - (sent & (chunk_len - 1)));
+			seg_done = request->split &&
+				   sent + len == request->seg_end[seg];
+			ret = ms912x_submit_chunk(request, sent, len, seg_done);
+			sent += len;
+			/* Skip the padding up to the next segment */
+			if (seg_done && seg + 1 < request->damage.count)
+				sent = request->seg_start[++seg];
+		}
+	}
+
+	if (ret)
+		cmpxchg(&request->status, 0, ret);
+
+	ms912x_request_put(request);
+}
+
+/*
+ * Ring indices stay below ring_size. Free-running ones would jump to a
+ * different slot on wraparound whenever ring_size is not a power of two.
+ */
+static inline struct ms912x_usb_request *
+ms912x_ring_slot(struct ms912x_device *ms912x, unsigned int index)
+{
+	return &ms912x->requests[index];
+}
+
+static inline unsigned int ms912x_ring_next(struct ms912x_device *ms912x,
+					    unsigned int index)
+{
+	return index + 1 < ms912x->ring_size ? index + 1 : 0;
+}
+
+static inline unsigned int ms912x_ring_prev(struct ms912x_device *ms912x,
+					    unsigned int index)
+{
+	return index ? index - 1 : ms912x->ring_size - 1;
+}
+
+/**
+ * ms912x_tx_work - Consumer side of the request ring
+ * @work: tx_work of the device, runs on its tx_worker
+ *
+ * Claims queued slots in ring order and streams them. The ring is single
+ * producer (flush_work) / single consumer (this work): the slot state
+ * is the only thing both sides write, and every transition is either done
+ * by one side only or arbitrated by cmpxchg.
+ */
+static void ms912x_tx_work(struct kthread_work *work)
+{
+	struct ms912x_device *ms912x =
+		container_of(work, struct ms912x_device, tx_work);
+	struct ms912x_usb_request *request;
+	int state;
+
+	while (!ms912x_device_gone(ms912x)) {
+		request = ms912x_ring_slot(ms912x, ms912x->ring_tail);
+		state = atomic_cmpxchg_acquire(&request->state,
+					       MS912X_SLOT_QUEUED,
+					       MS912X_SLOT_SENDING);
+		if (state == MS912X_SLOT_FILLING) {
+			/* The producer is folding new damage into it */
+			wait_event_timeout(ms912x->tx_wait,
+					   atomic_read(&request->state) !=
+							   MS912X_SLOT_FILLING ||
+						   ms912x_device_gone(ms912x),
+					   msecs_to_jiffies(MS912X_REQUEST_TIMEOUT_MS));
+			continue;
+		}
+		if (state != MS912X_SLOT_QUEUED)
+			break;
+
+		ms912x->ring_tail = ms912x_ring_next(ms912x, ms912x->ring_tail);
+		request->sent_at = ktime_get();
+		ms912x_stream_request(request);
+	}
+}
+
+/**
+ * ms912x_ring_acquire - Get a slot for the next frame from the producer side
+ * @ms912x: device
+ * @damage: damage of the new frame, extended by the damage of a replaced frame
+ *
+ * Takes the next free slot. If the ring is full, the newest queued frame
+ * that has not gone on the wire yet is taken back instead ("mailbox") and
+ * its damage is merged into @damage, so nothing it carried is lost.
+ *
+ * Returns the slot to fill, or ERR_PTR(-EBUSY) if every slot is already
+ * being sent; the caller then keeps the damage for the next update.
+ */
+static struct ms912x_usb_request *
+ms912x_ring_acquire(struct ms912x_device *ms912x, struct ms912x_damage *damage)
+{
+	struct ms912x_usb_request *request, *newest;
+
+	request = ms912x_ring_slot(ms912x, ms912x->ring_head);
+	if (atomic_read_acquire(&request->state) == MS912X_SLOT_FREE) {
+		ms912x->ring_head = ms912x_ring_next(ms912x, ms912x->ring_head);
+		atomic64_inc(&ms912x->ring_stats.queued);
+		request->commit_at = 0;
+		return request;
+	}
+
+	newest = ms912x_ring_slot(ms912x,
+				  ms912x_ring_prev(ms912x, ms912x->ring_head));
+	if (atomic_cmpxchg(&newest->state, MS912X_SLOT_QUEUED,
+			   MS912X_SLOT_FILLING) == MS912X_SLOT_QUEUED) {
+		ms912x_damage_merge(damage, &newest->damage, ms912x->cpp);
+		atomic64_inc(&ms912x->ring_stats.replaced);
+		ms912x_stats_inc(ms912x, MS912X_STAT_COALESCED);
+		return newest;
+	}
+
+	atomic64_inc(&ms912x->ring_stats.deferred);
+	return ERR_PTR(-EBUSY);
+}
+
+/**
+ * ms912x_request_start - Publish a slot to the streaming transmitter
+ * @ms912x: device
+ * @request: slot from ms912x_ring_acquire() with damage and layout set
+ *
+ * Must be called before the frame is converted; the converter then
+ * publishes its progress with ms912x_request_publish().
+ */
+static void ms912x_request_start(struct ms912x_device *ms912x,
+				 struct ms912x_usb_request *request)
+{
+	request->ready_len = 0;
+	request->status = 0;
+	/* Reference owned by the consumer until the last chunk is submitted */
+	atomic_set(&request->pending_urbs, 1);
+	atomic_set_release(&request->state, MS912X_SLOT_QUEUED);
+	wake_up_all(&ms912x->tx_wait);
+	kthread_queue_work(ms912x->tx_worker, &ms912x->tx_work);
+}
+
+static void ms912x_request_publish(struct ms912x_usb_request *request,
+				   size_t ready_len)
+{
+	smp_store_release(&request->ready_len, ready_len);
+	wake_up_all(&request->ms912x->tx_wait);
+}
+
+static bool ms912x_ring_idle(struct ms912x_device *ms912x)
+{
+	unsigned int i;
+
+	for (i = 0; i < ms912x->ring_size; i++) {
+		if (atomic_read(&ms912x->requests[i].state) !=
+		    MS912X_SLOT_FREE)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * ms912x_ring_drain - Wait until every frame in the ring went out
+ * @ms912x: device
+ * @timeout_ms: how long to wait at most
+ *
+ * Gives up early once the device is gone, frames left in the ring are
+ * then dropped by ms912x_free_urbs().
+ *
+ * Returns true if the ring is idle.
+ */
+bool ms912x_ring_drain(struct ms912x_device *ms912x, unsigned int timeout_ms)
+{
+	wait_event_timeout(ms912x->tx_wait,
+			   ms912x_ring_idle(ms912x) || ms912x_device_gone(ms912x),
+			   msecs_to_jiffies(timeout_ms));
+
+	return ms912x_ring_idle(ms912x);
 }
 
 void ms912x_free_request(struct ms912x_usb_request *request)
@@ -96,30 +509,28 @@ void ms912x_free_request(struct ms912x_usb_request *request)
 		return;
 	}
 	
-	// Отменяем рабочий поток, если он активен
-	if (work_pending(&request->work)) {
-		pr_debug("ms912x: canceling pending work\n");
-		cancel_work_sync(&request->work);
-	}
-	
 	// Удаляем таймер, если он активен
 	if (timer_pending(&request->timer)) {
 		pr_debug("ms912x: deleting pending timer\n");
 		timer_delete_sync(&request->timer);
 	}
 	
-	if (request->transfer_buffer) {
-		sg_free_table(&request->transfer_sgt);
-		vfree(request->transfer_buffer);
+	if (request->xfer) {
+		ms912x_pool_free(request->xfer);
+		request->xfer = NULL;
 		request->transfer_buffer = NULL;
 	}
 
 	kfree(request->temp_buffer);
 	request->temp_buffer = NULL;
 	request->alloc_len = 0;
+	request->temp_len = 0;
 	
-	// Инициализируем структуру завершения для предотвращения зависаний
-	init_completion(&request->done);
+	/* Flips of a frame dropped at disconnect */
+	if (request->ms912x)
+		ms912x_vblank_send_events(request->ms912x, &request->events);
+
+	atomic_set(&request->state, MS912X_SLOT_FREE);
 	
 	// Добавляем дополнительную диагностику при освобождении запроса
 	if (request->ms912x) {
@@ -129,14 +540,8 @@ void ms912x_free_request(struct ms912x_usb_request *request)
 }
 
 int ms912x_init_request(struct ms912x_device *ms912x,
-			struct ms912x_usb_request *request, size_t len)
+			struct ms912x_usb_request *request)
 {
-	int ret, i;
-	unsigned int num_pages;
-	void *data;
-	struct page **pages;
-	void *ptr;
-
 	// Добавляем проверки на NULL
 	if (!ms912x) {
 		pr_err("ms912x: invalid device pointer\n");
@@ -147,230 +552,778 @@ int ms912x_init_request(struct ms912x_device *ms912x,
 		pr_err("ms912x: invalid request pointer\n");
 		return -EINVAL;
 	}
+
+	/* Buffers come with the first modeset, see ms912x_ring_install() */
+	request->transfer_buffer = NULL;
+	request->xfer = NULL;
+	request->temp_buffer = NULL;
+	request->alloc_len = 0;
+	request->ms912x = ms912x;
+	INIT_LIST_HEAD(&request->events);
+
+	atomic_set(&request->state, MS912X_SLOT_FREE);
 	
-	if (len == 0) {
-		pr_err("ms912x: invalid length\n");
-		return -EINVAL;
-	}
+	// Инициализируем таймер для запроса
+	timer_setup(&request->timer, ms912x_request_timeout, 0);
+	
+	pr_debug("ms912x: [%s] USB request initialized\n", ms912x->device_name);
+	return 0;
+}
 
-	data = vmalloc_32(len);
-	if (!data) {
-		pr_err("ms912x: failed to allocate transfer buffer\n");
-		return -ENOMEM;
+/*
+ * Transfer buffer size for a full frame update of @width x @height with
+ * @cpp bytes per pixel
+ */
+static size_t ms912x_frame_buffer_len(int width, int height, unsigned int cpp)
+{
+	struct drm_rect rect;
+
+	drm_rect_init(&rect, 0, 0, ALIGN_DOWN(width, 16), height);
+
+	return PAGE_ALIGN(ms912x_damage_segment_len(&rect, cpp));
+}
+
+/**
+ * ms912x_ring_buffers_fit - Check if the ring's buffers match a mode
+ * @ms912x: device
+ * @width: horizontal resolution
+ * @height: vertical resolution
+ * @cpp: bytes per pixel of the wire format
+ *
+ * True if the buffers installed now have exactly the size @width x @height
+ * needs, so a modeset can keep them.
+ */
+bool ms912x_ring_buffers_fit(struct ms912x_device *ms912x, int width,
+			     int height, unsigned int cpp)
+{
+	struct ms912x_usb_request *request = &ms912x->requests[0];
+
+	return request->xfer &&
+	       request->alloc_len ==
+		       ms912x_frame_buffer_len(width, height, cpp) &&
+	       request->temp_len >= width * 4;
+}
+
+/**
+ * ms912x_ring_buffers_alloc - Allocate the ring's buffers for a mode
+ * @ms912x: device
+ * @width: horizontal resolution
+ * @height: vertical resolution
+ * @cpp: bytes per pixel of the wire format
+ *
+ * Called from ms912x_pipe_prepare_fb(), before the point of no return, so
+ * that a mode that does not fit into memory fails the commit instead of
+ * the device going dark. TEST_ONLY commits do not reach prepare_fb and
+ * cannot see such a failure. Transfer buffers
+ * come from the pool when one of the right size is idle. The buffers are
+ * only installed by ms912x_ring_install() when the commit is applied.
+ */
+struct ms912x_ring_buffers *
+ms912x_ring_buffers_alloc(struct ms912x_device *ms912x, int width, int height,
+			  unsigned int cpp)
+{
+	struct usb_bus *bus = interface_to_usbdev(ms912x->intf)->bus;
+	struct ms912x_ring_buffers *buffers;
+	unsigned int i;
+
+	buffers = kzalloc(sizeof(*buffers), GFP_KERNEL);
+	if (!buffers)
+		return ERR_PTR(-ENOMEM);
+
+	buffers->count = ms912x->ring_size;
+	buffers->transfer_len = ms912x_frame_buffer_len(width, height, cpp);
+	buffers->temp_len = width * 4;
+
+	for (i = 0; i < buffers->count; i++) {
+		buffers->transfer[i] = ms912x_pool_get(bus->sysdev,
+						       bus->uses_dma,
+						       buffers->transfer_len);
+		buffers->temp[i] = kmalloc(buffers->temp_len, GFP_KERNEL);
+		if (!buffers->transfer[i] || !buffers->temp[i]) {
+			pr_err("ms912x: [%s] failed to allocate transfer buffers for %dx%d\n",
+			       ms912x->device_name, width, height);
+			ms912x_ring_buffers_free(ms912x, buffers);
+			return ERR_PTR(-ENOMEM);
+		}
 	}
 
-	request->temp_buffer = kmalloc(1920 * 4, GFP_KERNEL);
-	if (!request->temp_buffer) {
-		pr_err("ms912x: failed to allocate temp buffer\n");
-		vfree(data);
-		return -ENOMEM;
+	pr_debug("ms912x: [%s] %u transfer buffers of %zu bytes allocated for %dx%d\n",
+		 ms912x->device_name, buffers->count, buffers->transfer_len,
+		 width, height);
+	return buffers;
+}
+
+/* Pool a transfer buffer, unless its controller may be going away too */
+static void ms912x_xfer_buf_release(struct ms912x_device *ms912x,
+				    struct ms912x_xfer_buf *buf)
+{
+	if (ms912x->drm.unplugged)
+		ms912x_pool_free(buf);
+	else
+		ms912x_pool_put(buf);
+}
+
+void ms912x_ring_buffers_free(struct ms912x_device *ms912x,
+			      struct ms912x_ring_buffers *buffers)
+{
+	unsigned int i;
+
+	if (!buffers)
+		return;
+
+	for (i = 0; i < buffers->count; i++) {
+		ms912x_xfer_buf_release(ms912x, buffers->transfer[i]);
+		kfree(buffers->temp[i]);
 	}
+	kfree(buffers);
+}
+
+/**
+ * ms912x_ring_reset - Bring the ring back to all slots FREE
+ * @ms912x: device
+ *
+ * Leaves nothing on the wire and keeps the buffers. The producer must be
+ * stopped; frames still queued after a short drain are dropped.
+ */
+void ms912x_ring_reset(struct ms912x_device *ms912x)
+{
+	unsigned int i;
 
-	num_pages = DIV_ROUND_UP(len, PAGE_SIZE);
-	pages = kmalloc_array(num_pages, sizeof(struct page *), GFP_KERNEL);
-	if (!pages) {
-		pr_err("ms912x: failed to allocate pages array\n");
-		ret = -ENOMEM;
-		goto err_vfree;
+	if (!ms912x_ring_drain(ms912x, 1000))
+		pr_debug("ms912x: [%s] dropping frames left in the request ring\n",
+			 ms912x->device_name);
+
+	kthread_cancel_work_sync(&ms912x->tx_work);
+	usb_kill_anchored_urbs(&ms912x->tx_anchor);
+
+	for (i = 0; i < ms912x->ring_size; i++) {
+		timer_delete_sync(&ms912x->requests[i].timer);
+		/* A dropped frame still completes its flips */
+		ms912x_vblank_send_events(ms912x, &ms912x->requests[i].events);
+		atomic_set(&ms912x->requests[i].state, MS912X_SLOT_FREE);
 	}
+	ms912x->ring_head = 0;
+	ms912x->ring_tail = 0;
+}
 
-	for (i = 0, ptr = data; i < num_pages; i++, ptr += PAGE_SIZE)
-		pages[i] = vmalloc_to_page(ptr);
+/**
+ * ms912x_ring_install - Switch the ring over to new buffers
+ * @ms912x: device
+ * @buffers: buffers from ms912x_ring_buffers_alloc(), consumed
+ *
+ * Called from pipe_enable with the producer stopped. The old buffers go
+ * back to the pool once no URB can reference them any more.
+ */
+void ms912x_ring_install(struct ms912x_device *ms912x,
+			 struct ms912x_ring_buffers *buffers)
+{
+	struct ms912x_usb_request *request;
+	unsigned int i;
 
-	ret = sg_alloc_table_from_pages(&request->transfer_sgt, pages,
-					num_pages, 0, len, GFP_KERNEL);
-	kfree(pages);
-	if (ret) {
-		pr_err("ms912x: failed to allocate sg table: %d\n", ret);
-		goto err_vfree;
+	ms912x_ring_reset(ms912x);
+
+	for (i = 0; i < ms912x->ring_size; i++) {
+		request = &ms912x->requests[i];
+		swap(request->xfer, buffers->transfer[i]);
+		request->transfer_buffer = request->xfer->vaddr;
+		swap(request->temp_buffer, buffers->temp[i]);
+		request->alloc_len = buffers->transfer_len;
+		request->temp_len = buffers->temp_len;
 	}
 
-	request->alloc_len = len;
-	request->transfer_buffer = data;
-	request->ms912x = ms912x;
+	pr_info("ms912x: [%s] transfer buffers resized to %zu bytes\n",
+		ms912x->device_name, ms912x->requests[0].alloc_len);
 
-	init_completion(&request->done);
-	INIT_WORK(&request->work, ms912x_request_work);
-	
-	// Инициализируем таймер для запроса
-	timer_setup(&request->timer, ms912x_request_timeout, 0);
-	
-	pr_debug("ms912x: request initialized successfully, len=%zu\n", len);
-	pr_info("ms912x: [%s] USB request initialized: len=%zu, temp_buffer=%p, transfer_buffer=%p\n",
-	        ms912x->device_name, len, request->temp_buffer, request->transfer_buffer);
-	return 0;
+	/* Now holds the old buffers */
+	ms912x_ring_buffers_free(ms912x, buffers);
+}
 
-err_vfree:
-	vfree(data);
-	kfree(request->temp_buffer);
-	request->temp_buffer = NULL;
-	return ret;
+/**
+ * ms912x_ring_release - Hand the ring's buffers back to the pool
+ * @ms912x: device
+ *
+ * Called from pipe_disable with the producer stopped, so a display that
+ * is off does not hold on to its transfer buffers. The next modeset gets
+ * them back from the pool.
+ */
+void ms912x_ring_release(struct ms912x_device *ms912x)
+{
+	struct ms912x_usb_request *request;
+	unsigned int i;
+
+	ms912x_ring_reset(ms912x);
+
+	for (i = 0; i < ms912x->ring_size; i++) {
+		request = &ms912x->requests[i];
+		ms912x_xfer_buf_release(ms912x, request->xfer);
+		kfree(request->temp_buffer);
+		request->xfer = NULL;
+		request->transfer_buffer = NULL;
+		request->temp_buffer = NULL;
+		request->alloc_len = 0;
+		request->temp_len = 0;
+	}
 }
 
-struct ms912x_yuv_lut {
-	u16 y_r[256], y_g[256], y_b[256];
-	u16 u_r[256], u_g[256], u_b[256];
-	u16 v_r[256], v_g[256], v_b[256];
-};
+/*
+ * CPUs close to the host controller: where its interrupt is delivered if
+ * it has a legacy one, else its NUMA node.
+ */
+static const struct cpumask *ms912x_tx_cpus_near(struct ms912x_device *ms912x)
+{
+	struct usb_bus *bus = interface_to_usbdev(ms912x->intf)->bus;
+	struct usb_hcd *hcd = bus_to_hcd(bus);
+	struct irq_data *data = hcd->irq ? irq_get_irq_data(hcd->irq) : NULL;
+	const struct cpumask *mask;
+	int node;
+
+	if (data) {
+		mask = irq_data_get_effective_affinity_mask(data);
+		if (!cpumask_empty(mask))
+			return mask;
+	}
 
-static struct ms912x_yuv_lut yuv_lut;
+	node = dev_to_node(bus->sysdev);
+	if (node != NUMA_NO_NODE)
+		return cpumask_of_node(node);
+
+	return cpu_online_mask;
+}
 
 /**
- * ms912x_init_yuv_lut - Initialize the YUV lookup table for RGB to YUV conversion
- *
- * This function pre-calculates and initializes the YUV lookup table with
- * fixed-point coefficients for efficient RGB to YUV color space conversion.
- * The lookup table contains pre-computed values for the Y, U, and V components
- * based on the standard RGB to YUV conversion formulas.
- *
- * The YUV conversion uses the following formulas:
- * Y = 0.257*R + 0.504*G + 0.098*B + 16
- * U = -0.148*R - 0.291*G + 0.439*B + 128
- * V = 0.439*R - 0.368*G - 0.071*B + 128
+ * ms912x_tx_worker_create - Start the device's transmit thread
+ * @ms912x: device
  *
- * The coefficients are scaled by 2^16 for fixed-point arithmetic.
+ * Every device streams from its own kthread_worker, so frames do not
+ * queue up behind unrelated work. The tx_fifo and tx_cpu parameters
+ * make it a real-time thread and pin it.
  */
-void ms912x_init_yuv_lut(void)
+static int ms912x_tx_worker_create(struct ms912x_device *ms912x)
 {
-	for (int i = 0; i < 256; i++) {
-		yuv_lut.y_r[i] = (16763 * i) >> 16;
-		yuv_lut.y_g[i] = (32904 * i) >> 16;
-		yuv_lut.y_b[i] = (6391 * i) >> 16;
+	struct kthread_worker *worker;
+	const struct cpumask *mask = NULL;
+	int cpu = READ_ONCE(tx_cpu);
+	int ret;
 
-		yuv_lut.u_r[i] = (-9676 * i) >> 16;
-		yuv_lut.u_g[i] = (-18996 * i) >> 16;
-		yuv_lut.u_b[i] = (28672 * i) >> 16;
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0))
+	worker = kthread_run_worker(0, "ms912x-%u-tx", ms912x->device_id);
+#else
+	worker = kthread_create_worker(0, "ms912x-%u-tx", ms912x->device_id);
+#endif
+	if (IS_ERR(worker)) {
+		pr_err("ms912x: [%s] failed to create transmit thread: %ld\n",
+		       ms912x->device_name, PTR_ERR(worker));
+		return PTR_ERR(worker);
+	}
+	ms912x->tx_worker = worker;
+
+	if (READ_ONCE(tx_fifo))
+		sched_set_fifo(worker->task);
+
+	if (cpu == MS912X_TX_CPU_NEAR)
+		mask = ms912x_tx_cpus_near(ms912x);
+	else if (cpu >= 0 && cpu < nr_cpu_ids && cpu_online(cpu))
+		mask = cpumask_of(cpu);
+	else if (cpu != MS912X_TX_CPU_ANY)
+		pr_warn("ms912x: [%s] tx_cpu %d is not online, not pinning\n",
+			ms912x->device_name, cpu);
 
-		yuv_lut.v_r[i] = (28672 * i) >> 16;
-		yuv_lut.v_g[i] = (-24009 * i) >> 16;
-		yuv_lut.v_b[i] = (-4663 * i) >> 16;
+	if (mask) {
+		ret = set_cpus_allowed_ptr(worker->task, mask);
+		if (ret)
+			pr_warn("ms912x: [%s] failed to pin transmit thread: %d\n",
+				ms912x->device_name, ret);
 	}
-		  pr_debug("ms912x: ms912x_init_yuv_lut complete\n");
-	
-	// Добавляем дополнительную диагностику при инициализации таблицы цветов
-	pr_info("ms912x: YUV lookup table initialized with 256 entries for each component\n");
 
+	pr_info("ms912x: [%s] transmit thread %s%s, CPUs %*pbl\n",
+		ms912x->device_name, worker->task->comm,
+		READ_ONCE(tx_fifo) ? " (SCHED_FIFO)" : "",
+		cpumask_pr_args(worker->task->cpus_ptr));
+	return 0;
 }
 
-static inline unsigned int ms912x_rgb_to_y(u8 r, u8 g, u8 b)
+/**
+ * ms912x_init_urbs - Allocate the per-device pool of bulk URBs
+ * @ms912x: device
+ *
+ * Every URB carries at most tx_chunk_len bytes, one physically
+ * contiguous chunk of a transfer buffer.
+ */
+int ms912x_init_urbs(struct ms912x_device *ms912x)
 {
-	unsigned int y = 16 + yuv_lut.y_r[r] + yuv_lut.y_g[g] + yuv_lut.y_b[b];
-	
-	// Добавляем дополнительную диагностику при преобразовании Y компонента
-	if (y > 255) y = 255;
-	
-	return y;
+	int i, ret;
+
+	INIT_LIST_HEAD(&ms912x->free_urbs);
+	spin_lock_init(&ms912x->urb_lock);
+	sema_init(&ms912x->free_urb_count, 0);
+	init_usb_anchor(&ms912x->tx_anchor);
+	init_waitqueue_head(&ms912x->tx_wait);
+	kthread_init_work(&ms912x->tx_work, ms912x_tx_work);
+	ms912x->ring_head = 0;
+	ms912x->ring_tail = 0;
+
+	ms912x->tx_chunk_len = MS912X_MAX_TRANSFER_LENGTH;
+
+	ret = ms912x_tx_worker_create(ms912x);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < MS912X_TOTAL_URBS; i++) {
+		struct ms912x_urb *ms_urb = &ms912x->urbs[i];
+
+		ms_urb->urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!ms_urb->urb) {
+			pr_err("ms912x: [%s] failed to allocate URB %d\n",
+			       ms912x->device_name, i);
+			ms912x_free_urbs(ms912x);
+			return -ENOMEM;
+		}
+		ms_urb->ms912x = ms912x;
+		ms912x_put_urb(ms912x, ms_urb);
+	}
+
+	pr_info("ms912x: [%s] %d bulk URBs allocated, chunk size %zu\n",
+		ms912x->device_name, MS912X_TOTAL_URBS, ms912x->tx_chunk_len);
+	return 0;
 }
 
-static inline unsigned int ms912x_rgb_to_u(u8 r, u8 g, u8 b)
+void ms912x_free_urbs(struct ms912x_device *ms912x)
 {
-	unsigned int u = 128 + yuv_lut.u_r[r] + yuv_lut.u_g[g] + yuv_lut.u_b[b];
-	
-	// Добавляем дополнительную диагностику при преобразовании U компонента
-	if (u > 255) u = 255;
-	
-	return u;
+	int i;
+
+	if (ms912x->tx_worker)
+		kthread_cancel_work_sync(&ms912x->tx_work);
+	usb_kill_anchored_urbs(&ms912x->tx_anchor);
+
+	for (i = 0; i < MS912X_TOTAL_URBS; i++) {
+		usb_free_urb(ms912x->urbs[i].urb);
+		ms912x->urbs[i].urb = NULL;
+	}
+
+	if (ms912x->tx_worker) {
+		kthread_destroy_worker(ms912x->tx_worker);
+		ms912x->tx_worker = NULL;
+	}
 }
 
-static inline unsigned int ms912x_rgb_to_v(u8 r, u8 g, u8 b)
+/*
+ * Framebuffers in system memory are converted in place. Lines of one in
+ * I/O memory, e.g. an imported dma-buf in VRAM, are first copied into
+ * @temp_buffer, with streaming loads if @stream is set.
+ */
+static int ms912x_convert_line(u8 *transfer_buffer, struct iosys_map *fb_buffer,
+			       size_t offset, size_t width, unsigned int src_cpp,
+			       u32 *temp_buffer,
+			       const struct ms912x_convert_kernel *kernel,
+			       bool stream)
 {
-	unsigned int v = 128 + yuv_lut.v_r[r] + yuv_lut.v_g[g] + yuv_lut.v_b[b];
-	
-	// Добавляем дополнительную диагностику при преобразовании V компонента
-	if (v > 255) v = 255;
-	
-	return v;
-}
-
-static int ms912x_xrgb_to_yuv422_line(u8 *transfer_buffer,
-				      struct iosys_map *xrgb_buffer,
-				      size_t offset, size_t width,
-				      u32 *temp_buffer)
-{
-	unsigned int i, dst_offset = 0;
-	unsigned int pixel1, pixel2;
-	unsigned int r1, g1, b1, r2, g2, b2;
-	unsigned int v, y1, u, y2;
-	unsigned int avg_r, avg_g, avg_b;
-	iosys_map_memcpy_from(temp_buffer, xrgb_buffer, offset, width * 4);
-	for (i = 0; i < width; i += 2) {
-		pixel1 = temp_buffer[i];
-		pixel2 = temp_buffer[i + 1];
-
-		r1 = (pixel1 >> 16) & 0xFF;
-		g1 = (pixel1 >> 8) & 0xFF;
-		b1 = pixel1 & 0xFF;
-		r2 = (pixel2 >> 16) & 0xFF;
-		g2 = (pixel2 >> 8) & 0xFF;
-		b2 = pixel2 & 0xFF;
-
-		y1 = ms912x_rgb_to_y(r1, g1, b1);
-		y2 = ms912x_rgb_to_y(r2, g2, b2);
-
-		avg_r = (r1 + r2) >> 1;
-		avg_g = (g1 + g2) >> 1;
-		avg_b = (b1 + b2) >> 1;
-
-		v = ms912x_rgb_to_v(avg_r, avg_g, avg_b);
-		u = ms912x_rgb_to_u(avg_r, avg_g, avg_b);
-
-		transfer_buffer[dst_offset++] = u;
-		transfer_buffer[dst_offset++] = y1;
-		transfer_buffer[dst_offset++] = v;
-		transfer_buffer[dst_offset++] = y2;
+	if (!fb_buffer->is_iomem) {
+		kernel->line(transfer_buffer, fb_buffer->vaddr + offset, width);
+	} else {
+		if (stream)
+			ms912x_copy_from_wc(temp_buffer,
+					    fb_buffer->vaddr_iomem + offset,
+					    width * src_cpp);
+		else
+			iosys_map_memcpy_from(temp_buffer, fb_buffer, offset,
+					      width * src_cpp);
+		kernel->line(transfer_buffer, temp_buffer, width);
 	}
-	
+
 	// Добавляем дополнительную диагностику при преобразовании строки
-	pr_debug("ms912x: line converted from XRGB8888 to YUV422: width=%zu\n", width);
-	
+	pr_debug("ms912x: line converted with %s: width=%zu\n", kernel->name,
+		 width);
+
 	return offset;
 }
 
-static const u8 ms912x_end_of_buffer[8] = { 0xff, 0xc0, 0x00, 0x00,
-					    0x00, 0x00, 0x00, 0x00 };
+/*
+ * Conversion in bands
+ *
+ * A frame is cut into bands of whole lines, each covering a contiguous
+ * range of the transfer buffer; header and trailer of a segment belong to
+ * its first and last band. flush_work converts bands itself and, for
+ * updates of at least parallel_threshold pixels, has the device's convert
+ * workers take bands in parallel. Bands finish in any order, but only the
+ * converted prefix of the buffer is published, so the streaming
+ * transmitter sees the same monotonic ready_len as with a single thread.
+ */
+
+/* Bands per converting thread, so fast threads take over from slow ones */
+#define MS912X_BANDS_PER_THREAD 4
+
+static unsigned int convert_threads;
+module_param(convert_threads, uint, 0444);
+MODULE_PARM_DESC(convert_threads,
+		 "Threads converting one frame, including the flush worker: 0 for one per online CPU up to "
+		 __stringify(MS912X_MAX_CONVERT_THREADS) " (default), 1 for no parallel conversion");
 
-static int ms912x_fb_xrgb8888_to_yuv422(void *dst, const struct iosys_map *src,
-					struct drm_framebuffer *fb,
-					struct drm_rect *rect,
-					void *temp_buffer)
+static unsigned int parallel_threshold = 256 * 1024;
+module_param(parallel_threshold, uint, 0644);
+MODULE_PARM_DESC(parallel_threshold,
+		 "Updates of fewer pixels are converted by the flush worker alone (default: 262144)");
+
+/*
+ * Record that band @b is converted up to @pos and publish the converted
+ * prefix of the transfer buffer.
+ */
+static void ms912x_job_progress(struct ms912x_convert_job *job, unsigned int b,
+				size_t pos)
 {
-	struct ms912x_frame_update_header *header =
-		(struct ms912x_frame_update_header *)dst;
+	struct ms912x_band *front;
+
+	spin_lock(&job->lock);
+	job->bands[b].pos = pos;
+	while (job->front + 1 < job->nr_bands &&
+	       job->bands[job->front].pos == job->bands[job->front].end)
+		job->front++;
+	front = &job->bands[job->front];
+	if (front->pos > job->published) {
+		job->published = front->pos;
+		ms912x_request_publish(job->request, front->pos);
+	}
+	spin_unlock(&job->lock);
+}
+
+static const u8 ms912x_end_of_buffer[MS912X_END_OF_BUFFER_LEN] = {
+	0xff, 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+/**
+ * ms912x_convert_band - Convert one band of a frame
+ * @job: conversion job of the frame
+ * @b: index of the band
+ * @temp_buffer: line buffer of the calling thread
+ *
+ * Writes the segment header if the band starts the segment, and the
+ * trailer if it ends it. Progress is reported every time a chunk's worth
+ * of the buffer is done, so the streaming work can put it on the wire
+ * while the rest of the band is converted.
+ *
+ * Each band is its own FPU section, so preemption is held off for one
+ * band at a time rather than for everything a thread takes.
+ */
+static void ms912x_convert_band(struct ms912x_convert_job *job, unsigned int b,
+				u32 *temp_buffer)
+{
+	struct ms912x_usb_request *request = job->request;
+	struct ms912x_band *band = &job->bands[b];
+	const struct drm_rect *rect = &request->damage.rects[band->seg];
+	unsigned int pitch = job->fb->pitches[0];
+	size_t chunk_len = request->ms912x->tx_chunk_len;
+	void *base = request->transfer_buffer;
+	void *dst = base + band->start;
+	size_t next_publish = ALIGN_DOWN(band->start, chunk_len) + chunk_len;
+	int x = rect->x1, width = drm_rect_width(rect);
 	struct iosys_map fb_map;
-	int i, x, y1, y2, width;
-
-	y1 = rect->y1;
-	y2 = (rect->y2 < fb->height) ? rect->y2 : fb->height;
-	x = rect->x1;
-	width = drm_rect_width(rect);
-
-	header->header = cpu_to_be16(0xff00);
-	header->x = x / 16;
-	header->y = cpu_to_be16(y1);
-	header->width = width / 16;
-	header->height = cpu_to_be16(drm_rect_height(rect));
-	dst += sizeof(*header);
-
-	fb_map = IOSYS_MAP_INIT_OFFSET(src, y1 * fb->pitches[0]);
-	for (i = y1; i < y2; i++) {
-		ms912x_xrgb_to_yuv422_line(dst, &fb_map, x * 4, width,
-					   temp_buffer);
-		iosys_map_incr(&fb_map, fb->pitches[0]);
-		dst += width * 2;
+	int y;
+
+	if (band->y1 == rect->y1) {
+		struct ms912x_frame_update_header *header = dst;
+
+		header->header = cpu_to_be16(0xff00);
+		header->x = x / 16;
+		header->y = cpu_to_be16(rect->y1);
+		header->width = width / 16;
+		header->height = cpu_to_be16(drm_rect_height(rect));
+		dst += sizeof(*header);
+	}
+
+	fb_map = IOSYS_MAP_INIT_OFFSET(job->src, band->y1 * pitch);
+	ms912x_convert_begin(job->kernel, job->stream);
+	for (y = band->y1; y < band->y2; y++) {
+		ms912x_convert_line(dst, &fb_map, x * job->src_cpp, width,
+				    job->src_cpp, temp_buffer, job->kernel,
+				    job->stream);
+		iosys_map_incr(&fb_map, pitch);
+		dst += width * job->cpp;
+
+		if (dst - base >= next_publish) {
+			ms912x_job_progress(job, b, dst - base);
+			next_publish = ALIGN_DOWN(dst - base, chunk_len) +
+				       chunk_len;
+		}
 	}
+	ms912x_convert_end(job->kernel, job->stream);
+
+	if (band->y2 == rect->y2) {
+		memcpy(dst, ms912x_end_of_buffer, sizeof(ms912x_end_of_buffer));
+		dst += sizeof(ms912x_end_of_buffer);
+	}
+
+	ms912x_job_progress(job, b, dst - base);
+}
+
+/* Take bands until none is left */
+static void ms912x_convert_run(struct ms912x_convert_job *job,
+			       u32 *temp_buffer)
+{
+	unsigned int b;
+
+	while ((b = atomic_inc_return(&job->next_band) - 1) < job->nr_bands)
+		ms912x_convert_band(job, b, temp_buffer);
+}
+
+static void ms912x_convert_work(struct work_struct *work)
+{
+	struct ms912x_convert_worker *worker =
+		container_of(work, struct ms912x_convert_worker, work);
+	struct ms912x_convert_job *job = &worker->ms912x->convert_job;
+
+	ms912x_convert_run(job, worker->temp_buffer);
+
+	if (atomic_dec_and_test(&job->running))
+		complete(&job->done);
+}
+
+/*
+ * Cut the segments of a request into bands of at most @band_lines lines,
+ * following the layout of ms912x_request_layout().
+ */
+static void ms912x_job_split(struct ms912x_convert_job *job, int band_lines)
+{
+	struct ms912x_damage *damage = &job->request->damage;
+	size_t seg_start, line_len;
+	struct ms912x_band *band;
+	const struct drm_rect *rect;
+	unsigned int i;
+	int y;
+
+	job->nr_bands = 0;
+	for (i = 0; i < damage->count; i++) {
+		rect = &damage->rects[i];
+		line_len = (size_t)drm_rect_width(rect) * job->cpp;
+		seg_start = job->request->seg_start[i];
+
+		for (y = rect->y1; y < rect->y2; y = band->y2) {
+			band = &job->bands[job->nr_bands++];
+			band->seg = i;
+			band->y1 = y;
+			band->y2 = rect->y2 - y > band_lines ? y + band_lines :
+							       rect->y2;
+			band->start = seg_start;
+			if (y != rect->y1)
+				band->start +=
+					sizeof(struct ms912x_frame_update_header) +
+					(y - rect->y1) * line_len;
+			band->end = seg_start +
+				    sizeof(struct ms912x_frame_update_header) +
+				    (band->y2 - rect->y1) * line_len;
+			if (band->y2 == rect->y2)
+				band->end += MS912X_END_OF_BUFFER_LEN;
+			band->pos = band->start;
+		}
+	}
+}
+
+/**
+ * ms912x_fb_convert - Convert the damage of a request
+ * @request: request started with ms912x_request_start()
+ * @src: mapped framebuffer
+ * @fb: framebuffer
+ * @kernel: kernel from the plane format to the wire format
+ *
+ * Segments are laid out back to back as computed by
+ * ms912x_request_layout(). Returns once the whole frame is converted.
+ */
+static int ms912x_fb_convert(struct ms912x_usb_request *request,
+			     const struct iosys_map *src,
+			     struct drm_framebuffer *fb,
+			     const struct ms912x_convert_kernel *kernel)
+{
+	struct ms912x_device *ms912x = request->ms912x;
+	struct ms912x_convert_job *job = &ms912x->convert_job;
+	struct ms912x_damage *damage = &request->damage;
+	unsigned int i, helpers = 0, max_bands;
+	size_t pixels = 0;
+	int lines = 0, band_lines = INT_MAX;
+
+	for (i = 0; i < damage->count; i++) {
+		pixels += (size_t)drm_rect_width(&damage->rects[i]) *
+			  drm_rect_height(&damage->rects[i]);
+		lines += drm_rect_height(&damage->rects[i]);
+	}
+
+	/* One band per segment unless the update is worth the hand-off */
+	if (ms912x->nr_convert_workers &&
+	    pixels >= READ_ONCE(parallel_threshold)) {
+		helpers = ms912x->nr_convert_workers;
+		max_bands = min_t(unsigned int,
+				  (helpers + 1) * MS912X_BANDS_PER_THREAD,
+				  MS912X_MAX_BANDS - MS912X_MAX_DAMAGE_RECTS);
+		band_lines = max_t(int, DIV_ROUND_UP(lines, max_bands), 1);
+	}
+
+	job->request = request;
+	job->src = src;
+	job->fb = fb;
+	job->cpp = ms912x->cpp;
+	job->src_cpp = fb->format->cpp[0];
+	job->kernel = kernel;
+	job->stream = src->is_iomem && ms912x_copy_from_wc_available();
+	ms912x_job_split(job, band_lines);
+	job->front = 0;
+	job->published = 0;
+	atomic_set(&job->next_band, 0);
+
+	helpers = min(helpers, job->nr_bands - 1);
+	atomic_set(&job->running, helpers + 1);
+	reinit_completion(&job->done);
+	for (i = 0; i < helpers; i++)
+		queue_work(ms912x->convert_wq, &ms912x->convert_workers[i].work);
+
+	ms912x_convert_run(job, request->temp_buffer);
+
+	/* The framebuffer mapping must outlive every band */
+	if (!atomic_dec_and_test(&job->running))
+		wait_for_completion(&job->done);
 	
 	// Добавляем дополнительную диагностику при преобразовании цветов
-	pr_debug("ms912x: frame converted from XRGB8888 to YUV422: rect=%dx%d\n",
-	         drm_rect_width(rect), drm_rect_height(rect));
+	pr_debug("ms912x: frame converted with %s: %u segments, %u bands, %u threads, %zu bytes\n",
+	         kernel->name,
+	         damage->count, job->nr_bands, helpers + 1, job->published);
 
-	memcpy(dst, ms912x_end_of_buffer, sizeof(ms912x_end_of_buffer));
 	return 0;
 }
 
+/**
+ * ms912x_convert_workers_init - Set up the threads for parallel conversion
+ * @ms912x: device
+ * @max_width: widest mode, sizes the line buffer of every worker
+ *
+ * Workers run on a per-device unbound workqueue. With convert_threads set
+ * to 1, or on a single CPU, there are none and flush_work converts alone.
+ */
+int ms912x_convert_workers_init(struct ms912x_device *ms912x, int max_width)
+{
+	unsigned int threads = READ_ONCE(convert_threads);
+	unsigned int i;
+
+	init_completion(&ms912x->convert_job.done);
+	spin_lock_init(&ms912x->convert_job.lock);
+
+	if (!threads)
+		threads = num_online_cpus();
+	threads = clamp_t(unsigned int, threads, 1, MS912X_MAX_CONVERT_THREADS);
+	if (threads == 1)
+		return 0;
+
+	ms912x->convert_wq = alloc_workqueue("ms912x-%u-cvt",
+					     WQ_UNBOUND | WQ_HIGHPRI,
+					     threads - 1, ms912x->device_id);
+	if (!ms912x->convert_wq)
+		return -ENOMEM;
+
+	ms912x->convert_workers = kcalloc(threads - 1,
+					  sizeof(*ms912x->convert_workers),
+					  GFP_KERNEL);
+	if (!ms912x->convert_workers)
+		goto err;
+
+	for (i = 0; i < threads - 1; i++) {
+		struct ms912x_convert_worker *worker =
+			&ms912x->convert_workers[i];
+
+		INIT_WORK(&worker->work, ms912x_convert_work);
+		worker->ms912x = ms912x;
+		worker->temp_buffer = kmalloc_array(max_width, sizeof(u32),
+						    GFP_KERNEL);
+		if (!worker->temp_buffer)
+			goto err;
+		ms912x->nr_convert_workers++;
+	}
+
+	pr_info("ms912x: [%s] %u threads convert updates of %u pixels and more\n",
+		ms912x->device_name, threads, READ_ONCE(parallel_threshold));
+	return 0;
+
+err:
+	ms912x_convert_workers_fini(ms912x);
+	return -ENOMEM;
+}
+
+void ms912x_convert_workers_fini(struct ms912x_device *ms912x)
+{
+	unsigned int i;
+
+	if (ms912x->convert_wq) {
+		destroy_workqueue(ms912x->convert_wq);
+		ms912x->convert_wq = NULL;
+	}
+
+	if (ms912x->convert_workers) {
+		for (i = 0; i < ms912x->nr_convert_workers; i++)
+			kfree(ms912x->convert_workers[i].temp_buffer);
+		kfree(ms912x->convert_workers);
+		ms912x->convert_workers = NULL;
+	}
+	ms912x->nr_convert_workers = 0;
+}
+
+/*
+ * Alignment of segment starts in the transfer buffer. A segment sent as
+ * a transfer of its own starts on a packet boundary, so that only its
+ * last URB can end in a short packet.
+ */
+static size_t ms912x_seg_align(struct ms912x_device *ms912x, bool split)
+{
+	struct usb_device *usbdev = interface_to_usbdev(ms912x->intf);
+
+	return split ? usb_maxpacket(usbdev, usb_sndbulkpipe(usbdev, 0x04)) :
+		       1;
+}
+
+/* Transfer buffer length of @damage, padding between segments included */
+static size_t ms912x_request_len(struct ms912x_device *ms912x,
+				 const struct ms912x_damage *damage,
+				 bool split)
+{
+	size_t align = ms912x_seg_align(ms912x, split);
+	size_t len = 0;
+	unsigned int i;
+
+	for (i = 0; i < damage->count; i++)
+		len = ALIGN(len, align) +
+		      ms912x_damage_segment_len(&damage->rects[i], ms912x->cpp);
 
-int
- ms912x_fb_send_rect(struct drm_framebuffer *fb, const struct iosys_map *map,
-			struct drm_rect *rect)
+	return len;
+}
+
+/* Segment boundaries and total length of a request's transfer buffer */
+static void ms912x_request_layout(struct ms912x_usb_request *request)
+{
+	size_t align = ms912x_seg_align(request->ms912x, request->split);
+	size_t len = 0;
+	unsigned int i;
+
+	for (i = 0; i < request->damage.count; i++) {
+		request->seg_start[i] = ALIGN(len, align);
+		len = request->seg_start[i] +
+		      ms912x_damage_segment_len(&request->damage.rects[i],
+						request->ms912x->cpp);
+		request->seg_end[i] = len;
+	}
+	request->transfer_len = len;
+}
+
+/**
+ * ms912x_fb_send_damage - Queue a frame update for the damage of @fb
+ * @fb: framebuffer
+ * @map: mapping of @fb
+ * @damage: damage to send, may grow by the damage of a replaced frame
+ * @events: page-flip events completed by this frame, moved to the
+ *          request on success
+ *
+ * Called from flush_work with flush_lock held, between
+ * drm_gem_fb_begin_cpu_access() and drm_gem_fb_end_cpu_access() on @fb.
+ *
+ * Returns 0 once the update is queued, -EBUSY if every ring slot is on the
+ * wire, or another negative error code.
+ */
+int ms912x_fb_send_damage(struct drm_framebuffer *fb,
+			  const struct iosys_map *map,
+			  struct ms912x_damage *damage,
+			  struct list_head *events)
 {
 	struct ms912x_device *ms912x = to_ms912x(fb->dev);
 	struct drm_device *drm;
@@ -385,6 +1338,7 @@ int
 	if (drm->unplugged || !READ_ONCE(drm->registered)) {
 		pr_debug("ms912x: [%s] device unplugged, skipping frame send\n",
 		         ms912x->device_name);
+		ms912x_stats_inc(ms912x, MS912X_STAT_DROP_UNPLUG);
 		return -ENODEV;
 	}
 	
@@ -399,8 +1353,8 @@ int
 		return -EINVAL;
 	}
 	
-	if (!rect) {
-		pr_err("ms912x: invalid rect pointer\n");
+	if (!damage || ms912x_damage_empty(damage)) {
+		pr_err("ms912x: invalid damage pointer\n");
 		return -EINVAL;
 	}
 	
@@ -408,135 +1362,90 @@ int
 	if (drm->unplugged || !READ_ONCE(drm->registered)) {
 		pr_debug("ms912x: [%s] device unplugged, skipping frame send\n",
 		         ms912x->device_name);
+		ms912x_stats_inc(ms912x, MS912X_STAT_DROP_UNPLUG);
 		return -ENODEV;
 	}
 	
 	// Добавляем дополнительную диагностику перед отправкой кадра
-	pr_debug("ms912x: [%s] preparing to send frame rect: x1=%d, y1=%d, x2=%d, y2=%d\n",
-	         ms912x->device_name, rect->x1, rect->y1, rect->x2, rect->y2);
+	pr_debug("ms912x: [%s] preparing to send frame: %u segments, first x1=%d, y1=%d, x2=%d, y2=%d\n",
+	         ms912x->device_name, damage->count, damage->rects[0].x1,
+	         damage->rects[0].y1, damage->rects[0].x2, damage->rects[0].y2);
 	
-	unsigned long now = jiffies;
-	if (time_before(now, ms912x->last_send_jiffies + msecs_to_jiffies(16)))
-		return 0;
-
+	bool split = READ_ONCE(segment_transfers);
 	int ret = 0, idx;
-	struct ms912x_usb_request *prev_request, *current_request;
-	int x, width;
-	
-	/* Seems like hardware can only update framebuffer
-	 * in multiples of 16 horizontally
-	 */
-	x = ALIGN_DOWN(rect->x1, 16);
-	/* Resolutions that are not a multiple of 16 like 1366*768
-	 * need to be aligned
-	 */
-	width = min(ALIGN(rect->x2, 16), ALIGN_DOWN((int)fb->width, 16)) - x;
-	rect->x1 = x;
-	rect->x2 = x + width;
+	struct ms912x_usb_request *request;
+	const struct ms912x_convert_kernel *kernel;
+	ktime_t start;
 
-	current_request = &ms912x->requests[ms912x->current_request];
-	prev_request = &ms912x->requests[1 - ms912x->current_request];
-
-	// Добавляем более подробное логирование перед вызовом drm_dev_enter
-	pr_debug("ms912x: [%s] attempting to enter drm device, current_request=%d\n",
-	         ms912x->device_name, ms912x->current_request);
-	
-	// Реализуем механизм повторных попыток для drm_dev_enter
-	int attempts = 0;
-	const int max_attempts = 10;  // Увеличиваем количество попыток
-	const int retry_delay_ms = 5; // Уменьшаем задержку между попытками
-	
-	do {
-		// Проверяем состояние устройства перед каждой попыткой
-		if (drm->unplugged || !READ_ONCE(drm->registered)) {
-			pr_err("ms912x: [%s] device is unplugged or not registered\n",
-			       ms912x->device_name);
-			return -ENODEV;
-		}
-		
-		ret = drm_dev_enter(drm, &idx);
-		if (ret) {
-			attempts++;
-			pr_debug("ms912x: [%s] drm_dev_enter attempt %d failed: %d\n",
-			         ms912x->device_name, attempts, ret);
-			
-			// Если это не последняя попытка, ждем немного
-			if (attempts < max_attempts) {
-				msleep(retry_delay_ms);
-			}
-		}
-	} while (ret && attempts < max_attempts);
-	
-	if (ret) {
-		pr_err("ms912x: [%s] failed to enter drm device after %d attempts: %d (device unplugged=%d, registered=%d)\n",
-		       ms912x->device_name, max_attempts, ret, drm->unplugged, READ_ONCE(drm->registered));
-		
-		// Добавляем дополнительную проверку состояния устройства
-		if (drm->unplugged || !READ_ONCE(drm->registered)) {
-			pr_info("ms912x: [%s] device is unplugged or unregistered, skipping frame send\n",
-			        ms912x->device_name);
-			return -ENODEV;
-		}
-		
-		return ret;
+	kernel = ms912x_convert_find(fb->format->format,
+				     ms912x->pix_fmt == MS912X_PIXFMT_RGB);
+	if (!kernel) {
+		pr_err("ms912x: [%s] no conversion for format %p4cc\n",
+		       ms912x->device_name, &fb->format->format);
+		return -EINVAL;
 	}
-	
-	pr_debug("ms912x: [%s] successfully entered drm device after %d attempts, idx=%d\n",
-	         ms912x->device_name, attempts, idx);
-	
-	// Дополнительная проверка, что устройство все еще подключено
-	if (drm->unplugged || !READ_ONCE(drm->registered)) {
-		pr_warn("ms912x: [%s] device was unplugged during drm_dev_enter\n",
-		        ms912x->device_name);
-		drm_dev_exit(idx);
-		return -ENODEV;
-		}
-		
-		// Проверка перед вызовом drm_gem_fb_begin_cpu_access
-		if (drm->unplugged || !READ_ONCE(drm->registered)) {
-			pr_warn("ms912x: [%s] device was unplugged before CPU access\n",
-			        ms912x->device_name);
-			drm_dev_exit(idx);
-			return -ENODEV;
-		}
-		
-		ret = drm_gem_fb_begin_cpu_access(fb, DMA_FROM_DEVICE);
-		if (ret < 0) {
-			pr_err("ms912x: failed to begin CPU access: %d\n", ret);
-			goto dev_exit;
-		}
 
-	ret = ms912x_fb_xrgb8888_to_yuv422(current_request->transfer_buffer,
-					   map, fb, rect,
-					   current_request->temp_buffer);
+	/*
+	 * drm_dev_enter() only fails once the device is gone, which retrying
+	 * does not change. This runs in flush_work, never in a commit.
+	 */
+	if (!drm_dev_enter(drm, &idx)) {
+		pr_debug("ms912x: [%s] device unplugged, skipping frame send\n",
+			 ms912x->device_name);
+		ms912x_stats_inc(ms912x, MS912X_STAT_DROP_DEV_ENTER);
+		return -ENODEV;
+	}
 
-	drm_gem_fb_end_cpu_access(fb, DMA_FROM_DEVICE);
-	if (ret < 0) {
-		pr_err("ms912x: failed to convert framebuffer: %d\n", ret);
+	/*
+	 * Overlapping segments of a large update may not fit, their bounding
+	 * box always does once the buffers match the mode. Merging in the
+	 * damage of a replaced frame keeps it inside the mode too.
+	 */
+	if (ms912x_request_len(ms912x, damage, split) >
+	    ms912x->requests[0].alloc_len)
+		ms912x_damage_flatten(damage);
+	if (ms912x_request_len(ms912x, damage, split) >
+	    ms912x->requests[0].alloc_len) {
+		pr_warn_ratelimited("ms912x: [%s] update does not fit the transfer buffer\n",
+				    ms912x->device_name);
+		ret = -ENOSPC;
+		ms912x_stats_inc(ms912x, MS912X_STAT_DROP_ERROR);
 		goto dev_exit;
 	}
 
-	/* Sending frames too fast, drop it */
-	if (!wait_for_completion_timeout(&prev_request->done,
-					 msecs_to_jiffies(1))) {
-		pr_warn("ms912x: previous request timed out\n");
-		ret = -ETIMEDOUT;
+	/* Every slot is on the wire: keep the damage for the next update */
+	request = ms912x_ring_acquire(ms912x, damage);
+	if (IS_ERR(request)) {
+		pr_debug("ms912x: [%s] request ring busy, deferring frame\n",
+			 ms912x->device_name);
+		ret = PTR_ERR(request);
 		goto dev_exit;
 	}
 
-	// Проверка перед постановкой работы в очередь
-	if (drm->unplugged || !READ_ONCE(drm->registered)) {
-		pr_warn("ms912x: [%s] device was unplugged before queueing work\n",
-		        ms912x->device_name);
-		ret = -ENODEV;
+	if (ms912x_request_len(ms912x, damage, split) > request->alloc_len)
+		ms912x_damage_flatten(damage);
+
+	request->damage = *damage;
+	request->split = split;
+	/* A replaced frame keeps its older commit time */
+	if (!request->commit_at)
+		request->commit_at = ms912x->flush_since;
+	/* Joins the events of a replaced frame, which never reaches the device */
+	list_splice_tail_init(events, &request->events);
+	ms912x_request_layout(request);
+	ms912x_request_start(ms912x, request);
+	ms912x_stats_inc(ms912x, MS912X_STAT_SUBMITTED);
+
+	start = ktime_get();
+	ret = ms912x_fb_convert(request, map, fb, kernel);
+	ms912x_stats_time(ms912x, MS912X_HIST_CONVERT,
+			  ktime_sub(ktime_get(), start));
+
+	if (ret < 0) {
+		pr_err("ms912x: failed to convert framebuffer: %d\n", ret);
 		goto dev_exit;
 	}
 
-	current_request->transfer_len = width * 2 * drm_rect_height(rect) + 16;
-	queue_work(system_long_wq, &current_request->work);
-	ms912x->current_request = 1 - ms912x->current_request;
-	ms912x->last_send_jiffies = jiffies;
-
 dev_exit:
 	drm_dev_exit(idx);
 	return ret;
@@ -0,0 +1,106 @@
+#include <linux/hrtimer.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/version.h>
+
+#include <drm/drm_vblank.h>
+
+#include "../include/ms912x.h"
+
+/*
+ * Emulated vblank
+ *
+ * The device reports nothing like a vblank, so vblank_timer ticks at the
+ * refresh rate of the active mode while DRM has vblank interrupts enabled.
+ * Page-flip events, and with them the out-fences, are not tied to that
+ * tick: a commit's event travels with its damage through flush_work into
+ * the request carrying the frame and is only sent once the last bulk URB
+ * of that request completed. Compositors therefore pace themselves to
+ * what the USB link delivers.
+ */
+
+static enum hrtimer_restart ms912x_vblank_timer_fn(struct hrtimer *timer)
+{
+	struct ms912x_device *ms912x =
+		container_of(timer, struct ms912x_device, vblank_timer);
+
+	/* disable_vblank can not wait for us, it runs under vblank locks */
+	if (!READ_ONCE(ms912x->vblank_enabled))
+		return HRTIMER_NORESTART;
+
+	hrtimer_forward_now(timer, ms912x->vblank_period);
+	drm_crtc_handle_vblank(&ms912x->display_pipe.crtc);
+
+	return HRTIMER_RESTART;
+}
+
+void ms912x_vblank_init(struct ms912x_device *ms912x)
+{
+	INIT_LIST_HEAD(&ms912x->events);
+	INIT_LIST_HEAD(&ms912x->flush_events);
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0))
+	hrtimer_setup(&ms912x->vblank_timer, ms912x_vblank_timer_fn,
+		      CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#else
+	hrtimer_init(&ms912x->vblank_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	ms912x->vblank_timer.function = ms912x_vblank_timer_fn;
+#endif
+	ms912x->vblank_period = ns_to_ktime(NSEC_PER_SEC / 60);
+}
+
+void ms912x_vblank_fini(struct ms912x_device *ms912x)
+{
+	WRITE_ONCE(ms912x->vblank_enabled, false);
+	hrtimer_cancel(&ms912x->vblank_timer);
+}
+
+/**
+ * ms912x_vblank_enable - Start ticking at the refresh rate of the CRTC's mode
+ * @ms912x: device
+ *
+ * Called by DRM through the pipe's enable_vblank hook, with interrupts
+ * disabled.
+ */
+int ms912x_vblank_enable(struct ms912x_device *ms912x)
+{
+	int hz = drm_mode_vrefresh(&ms912x->display_pipe.crtc.mode);
+
+	ms912x->vblank_period = ns_to_ktime(NSEC_PER_SEC / (hz > 0 ? hz : 60));
+	WRITE_ONCE(ms912x->vblank_enabled, true);
+	hrtimer_start(&ms912x->vblank_timer, ms912x->vblank_period,
+		      HRTIMER_MODE_REL);
+
+	return 0;
+}
+
+void ms912x_vblank_disable(struct ms912x_device *ms912x)
+{
+	WRITE_ONCE(ms912x->vblank_enabled, false);
+	hrtimer_try_to_cancel(&ms912x->vblank_timer);
+}
+
+/**
+ * ms912x_vblank_send_events - Complete page flips
+ * @ms912x: device
+ * @events: list of struct drm_pending_vblank_event, linked by base.link
+ *
+ * Sends every event on @events and leaves the list empty. Safe from URB
+ * completion context.
+ */
+void ms912x_vblank_send_events(struct ms912x_device *ms912x,
+			       struct list_head *events)
+{
+	struct drm_crtc *crtc = &ms912x->display_pipe.crtc;
+	struct drm_pending_vblank_event *event, *tmp;
+	unsigned long flags;
+
+	if (list_empty(events))
+		return;
+
+	spin_lock_irqsave(&ms912x->drm.event_lock, flags);
+	list_for_each_entry_safe(event, tmp, events, base.link) {
+		list_del_init(&event->base.link);
+		drm_crtc_send_vblank_event(crtc, event);
+	}
+	spin_unlock_irqrestore(&ms912x->drm.event_lock, flags);
+}
@@ -2,7 +2,9 @@
 
 #include <linux/version.h>
 #include <linux/module.h>
+#include <drm/drm_atomic.h>
 #include <drm/drm_atomic_helper.h>
+#include <drm/drm_atomic_state_helper.h>
 #include <drm/drm_crtc_helper.h>
 #include <drm/drm_damage_helper.h>
 #include <drm/drm_drv.h>
@@ -21,6 +23,8 @@
 #include <drm/drm_probe_helper.h>
 #include <drm/drm_print.h>
 #include <drm/drm_simple_kms_helper.h>
+#include <drm/drm_vblank.h>
+#include <linux/hrtimer.h>
 #include <linux/mutex.h>
 
 #include "ms912x.h"
@@ -46,6 +50,8 @@ static int ms912x_usb_suspend(struct usb_interface *interface,
 		struct ms912x_device *ms912x = to_ms912x(dev);
 		if (ms912x) {
 			pr_info("ms912x: [%s] suspending device operation\n", ms912x->device_name);
+			ms912x_hpd_stop(ms912x);
+			ms912x_diag_cancel(ms912x);
 		}
 	}
 	
@@ -55,16 +61,32 @@ static int ms912x_usb_suspend(struct usb_interface *interface,
 static int ms912x_usb_resume(struct usb_interface *interface)
 {
 	struct drm_device *dev = usb_get_intfdata(interface);
-	
+	int ret = drm_mode_config_helper_resume(dev);
+
 	// Добавляем дополнительную диагностику при возобновлении работы
 	if (dev) {
 		struct ms912x_device *ms912x = to_ms912x(dev);
 		if (ms912x) {
 			pr_info("ms912x: [%s] resuming device operation\n", ms912x->device_name);
+			ms912x_hpd_start(ms912x);
 		}
 	}
 	
-	return drm_mode_config_helper_resume(dev);
+	return ret;
+}
+
+/*
+ * The device was reset while suspended and forgot everything, so the
+ * mode goes out with the full sequence. A plain resume only replays it.
+ */
+static int ms912x_usb_reset_resume(struct usb_interface *interface)
+{
+	struct drm_device *dev = usb_get_intfdata(interface);
+
+	if (dev)
+		ms912x_regs_invalidate(to_ms912x(dev));
+
+	return ms912x_usb_resume(interface);
 }
 
 static struct drm_gem_object *
@@ -101,6 +123,7 @@ static const struct drm_driver driver = {
 	.fops = &ms912x_driver_fops,
 	DRM_GEM_SHMEM_DRIVER_OPS,
 	.gem_prime_import = ms912x_driver_gem_prime_import,
+	.debugfs_init = ms912x_debugfs_minor_init,
 	.name = DRIVER_NAME,
 	.desc = DRIVER_DESC,
 	.date = DRIVER_DATE,
@@ -115,6 +138,20 @@ static const struct drm_mode_config_funcs ms912x_mode_config_funcs = {
 	.atomic_commit = drm_atomic_helper_commit,
 };
 
+/*
+ * CRTC state carrying the transfer buffers allocated for a modeset from
+ * prepare_fb to pipe_enable.
+ */
+struct ms912x_crtc_state {
+	struct drm_crtc_state base;
+	/* NULL when the installed buffers already fit the mode */
+	struct ms912x_ring_buffers *buffers;
+	/* Wire format picked for the mode, 0 until checked */
+	int pix_fmt;
+};
+
+#define to_ms912x_crtc_state(x) container_of(x, struct ms912x_crtc_state, base)
+
 struct ms912x_mode ms912x_mode_list[] = {
 	/* Found in captures of the Windows driver */
 	MS912X_MODE( 800,  600, 60, 0x4200, MS912X_PIXFMT_UYVY),
@@ -179,6 +216,334 @@ ms912x_get_mode(const struct drm_display_mode *mode)
 	return ERR_PTR(-EINVAL);
 }
 
+/*
+ * Packed RGB needs 3 bytes per pixel against 2 for UYVY, but skips colour
+ * conversion and chroma subsampling. Neither format fits a full frame per
+ * refresh through a high-speed link at any mode, updates are damage only,
+ * so what decides is the extra byte per pixel RGB costs over UYVY. A mode
+ * is sent as RGB while that extra rate at full refresh stays within the
+ * link's budget, in MB/s. By link speed, the high-speed budget takes the
+ * modes up to 1024x768@60 (47 MB/s extra), SuperSpeed up to 1920x1080@60.
+ *
+ * The payload byte order of RGB is not verified on hardware yet, so RGB
+ * is opt-in: the default budget is 0 and every mode goes out as UYVY.
+ */
+#define MS912X_RGB_BUDGET_HS 48
+#define MS912X_RGB_BUDGET_SS 160
+
+static int rgb_budget;
+module_param(rgb_budget, int, 0644);
+MODULE_PARM_DESC(rgb_budget,
+		 "Extra bandwidth in MB/s over UYVY up to which modes are sent as RGB: 0 never (default), -1 by link speed");
+
+static int ms912x_mode_pix_fmt(struct ms912x_device *ms912x,
+			       const struct drm_display_mode *mode)
+{
+	struct usb_device *usbdev = interface_to_usbdev(ms912x->intf);
+	int budget = READ_ONCE(rgb_budget);
+	u64 rate;
+
+	if (budget < 0)
+		budget = usbdev->speed >= USB_SPEED_SUPER ?
+				 MS912X_RGB_BUDGET_SS : MS912X_RGB_BUDGET_HS;
+
+	rate = (u64)mode->hdisplay * mode->vdisplay *
+	       (ms912x_pixfmt_cpp(MS912X_PIXFMT_RGB) -
+		ms912x_pixfmt_cpp(MS912X_PIXFMT_UYVY)) *
+	       drm_mode_vrefresh(mode);
+
+	return rate <= (u64)budget * 1000000 ? MS912X_PIXFMT_RGB :
+					       MS912X_PIXFMT_UYVY;
+}
+
+/*
+ * Frame pacer
+ *
+ * A commit only merges its damage into ms912x->damage, takes a reference
+ * on the framebuffer and queues flush_work, so it never waits for a
+ * conversion or for USB. flush_work moves that damage through the tile
+ * hashes into flush_damage and sends it at most once per frame period of
+ * the active mode; before the next frame slot it only arms flush_timer,
+ * which queues flush_work again. Damage therefore waits at most one frame
+ * period and is never dropped. A failed send is retried by the timer too,
+ * with a growing interval while the failures last.
+ */
+
+/* Retry interval, in frame periods, while every ring slot is on the wire */
+#define MS912X_FLUSH_RETRY_DIV 4
+/* After a failed send, retry in 1, 2, 4, ... up to 32 frame periods */
+#define MS912X_FLUSH_BACKOFF_MAX 5
+
+static void ms912x_flush_arm(struct ms912x_device *ms912x, ktime_t expires)
+{
+	hrtimer_start(&ms912x->flush_timer, expires, HRTIMER_MODE_ABS);
+}
+
+/*
+ * Retry the kept damage later even if no commit comes, backing off while
+ * sends keep failing. Commits until then only merge their damage.
+ * Called with flush_lock held.
+ */
+static void ms912x_flush_backoff(struct ms912x_device *ms912x, ktime_t now)
+{
+	unsigned int shift = min_t(unsigned int, ms912x->flush_errors,
+				   MS912X_FLUSH_BACKOFF_MAX);
+
+	ms912x->flush_errors++;
+	ms912x->next_frame = ktime_add(now, ms912x->frame_period << shift);
+	ms912x_flush_arm(ms912x, ms912x->next_frame);
+}
+
+/* Called with flush_lock held */
+static void ms912x_flush_locked(struct ms912x_device *ms912x,
+				struct drm_framebuffer *fb,
+				const struct iosys_map *map,
+				const struct ms912x_damage *reported)
+{
+	struct ms912x_damage damage;
+	unsigned int i, divider;
+	size_t len;
+	ktime_t now;
+	int ret;
+
+	for (i = 0; i < reported->count; i++)
+		ms912x_tile_hash_filter(ms912x, fb, map, &reported->rects[i],
+					&ms912x->flush_damage);
+
+	/* Nothing the device does not show already, the flips are done */
+	if (ms912x_damage_empty(&ms912x->flush_damage)) {
+		ms912x->flush_since = 0;
+		ms912x_vblank_send_events(ms912x, &ms912x->flush_events);
+		return;
+	}
+
+	now = ktime_get();
+	damage = ms912x->flush_damage;
+	ret = ms912x_fb_send_damage(fb, map, &damage, &ms912x->flush_events);
+	if (ret == 0) {
+		ms912x_damage_init(&ms912x->flush_damage);
+		ms912x->flush_since = 0;
+		ms912x->flush_errors = 0;
+		/* damage now is what went into the request, flattened or not */
+		len = ms912x_damage_len(&damage, ms912x->cpp);
+		divider = ms912x_governor_update(ms912x, len);
+		ms912x->next_frame =
+			ktime_add(now, ms912x->frame_period * divider);
+	} else if (ret == -EBUSY) {
+		ms912x_flush_arm(ms912x,
+				 ktime_add(now,
+					   ktime_divns(ms912x->frame_period,
+						       MS912X_FLUSH_RETRY_DIV)));
+	} else {
+		/*
+		 * The damage stays for the retry, but the flips must not
+		 * wait for it.
+		 */
+		ms912x_vblank_send_events(ms912x, &ms912x->flush_events);
+		ms912x_flush_backoff(ms912x, now);
+	}
+}
+
+/*
+ * Swap the framebuffer flush_work reads from, returns the reference to
+ * drop outside of damage_lock. Called with damage_lock held.
+ */
+static struct drm_framebuffer *
+ms912x_flush_set_fb(struct ms912x_device *ms912x, struct drm_framebuffer *fb)
+{
+	struct drm_framebuffer *old = ms912x->flush_fb;
+
+	if (old == fb)
+		return NULL;
+
+	if (fb)
+		drm_framebuffer_get(fb);
+	ms912x->flush_fb = fb;
+
+	return old;
+}
+
+static enum hrtimer_restart ms912x_flush_timer_fn(struct hrtimer *timer)
+{
+	struct ms912x_device *ms912x =
+		container_of(timer, struct ms912x_device, flush_timer);
+
+	queue_work(system_highpri_wq, &ms912x->flush_work);
+
+	return HRTIMER_NORESTART;
+}
+
+static void ms912x_flush_work(struct work_struct *work)
+{
+	struct ms912x_device *ms912x =
+		container_of(work, struct ms912x_device, flush_work);
+	struct iosys_map map[DRM_FORMAT_MAX_PLANES];
+	struct iosys_map data[DRM_FORMAT_MAX_PLANES];
+	struct ms912x_damage damage;
+	struct drm_framebuffer *fb;
+	int ret;
+
+	mutex_lock(&ms912x->flush_lock);
+	if (!ms912x->flush_enabled)
+		goto out_unlock;
+
+	if (ktime_before(ktime_get(), ms912x->next_frame)) {
+		ms912x_stats_inc(ms912x, MS912X_STAT_PACED);
+		ms912x_flush_arm(ms912x, ms912x->next_frame);
+		goto out_unlock;
+	}
+
+	/*
+	 * Take what the commits reported since the last pass. Commits may
+	 * replace flush_fb meanwhile, keep this one alive.
+	 */
+	spin_lock(&ms912x->damage_lock);
+	fb = ms912x->flush_fb;
+	if (fb)
+		drm_framebuffer_get(fb);
+	damage = ms912x->damage;
+	ms912x_damage_init(&ms912x->damage);
+	if (!ms912x->flush_since && !ms912x_damage_empty(&damage))
+		ms912x->flush_since = ms912x->damage_since;
+	ms912x->damage_since = 0;
+	list_splice_tail_init(&ms912x->events, &ms912x->flush_events);
+	spin_unlock(&ms912x->damage_lock);
+
+	if (!fb || (ms912x_damage_empty(&damage) &&
+		    ms912x_damage_empty(&ms912x->flush_damage))) {
+		ms912x_vblank_send_events(ms912x, &ms912x->flush_events);
+		goto out_put;
+	}
+
+	/*
+	 * Nothing is shown without a sink. Keep the damage, unfiltered, for
+	 * the hotplug poller to flush once one is back.
+	 */
+	if (!READ_ONCE(ms912x->sink_connected)) {
+		ms912x_damage_merge(&ms912x->flush_damage, &damage,
+				    ms912x->cpp);
+		ms912x_vblank_send_events(ms912x, &ms912x->flush_events);
+		goto out_put;
+	}
+
+	ret = drm_gem_fb_vmap(fb, map, data);
+	if (ret) {
+		pr_err("ms912x: [%s] failed to map framebuffer for flush: %d\n",
+		       ms912x->device_name, ret);
+		/* Unfiltered, so nothing is lost */
+		ms912x_damage_merge(&ms912x->flush_damage, &damage,
+				    ms912x->cpp);
+		ms912x_vblank_send_events(ms912x, &ms912x->flush_events);
+		ms912x_flush_backoff(ms912x, ktime_get());
+		goto out_put;
+	}
+
+	/* The tile hashes read the framebuffer too, not only the conversion */
+	ret = drm_gem_fb_begin_cpu_access(fb, DMA_FROM_DEVICE);
+	if (ret) {
+		pr_err("ms912x: [%s] failed to begin CPU access: %d\n",
+		       ms912x->device_name, ret);
+		ms912x_stats_inc(ms912x, MS912X_STAT_DROP_ERROR);
+		ms912x_damage_merge(&ms912x->flush_damage, &damage,
+				    ms912x->cpp);
+		ms912x_vblank_send_events(ms912x, &ms912x->flush_events);
+		ms912x_flush_backoff(ms912x, ktime_get());
+		drm_gem_fb_vunmap(fb, map);
+		goto out_put;
+	}
+
+	ms912x_flush_locked(ms912x, fb, &data[0], &damage);
+	drm_gem_fb_end_cpu_access(fb, DMA_FROM_DEVICE);
+	drm_gem_fb_vunmap(fb, map);
+
+out_put:
+	if (fb)
+		drm_framebuffer_put(fb);
+out_unlock:
+	mutex_unlock(&ms912x->flush_lock);
+}
+
+static void ms912x_pacer_init(struct ms912x_device *ms912x)
+{
+	mutex_init(&ms912x->flush_lock);
+	spin_lock_init(&ms912x->damage_lock);
+	INIT_WORK(&ms912x->flush_work, ms912x_flush_work);
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0))
+	hrtimer_setup(&ms912x->flush_timer, ms912x_flush_timer_fn,
+		      CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+#else
+	hrtimer_init(&ms912x->flush_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	ms912x->flush_timer.function = ms912x_flush_timer_fn;
+#endif
+	ms912x_damage_init(&ms912x->damage);
+	ms912x_damage_init(&ms912x->flush_damage);
+	ms912x->frame_period = ns_to_ktime(NSEC_PER_SEC / 60);
+	ms912x_governor_init(ms912x);
+}
+
+static void ms912x_pacer_start(struct ms912x_device *ms912x, int hz)
+{
+	LIST_HEAD(events);
+
+	mutex_lock(&ms912x->flush_lock);
+	ms912x->frame_period = ns_to_ktime(NSEC_PER_SEC / (hz > 0 ? hz : 60));
+	ms912x->next_frame = 0;
+	ms912x->flush_errors = 0;
+	ms912x_governor_reset(ms912x);
+	ms912x->flush_enabled = true;
+	mutex_unlock(&ms912x->flush_lock);
+
+	/*
+	 * The default commit_tail updates the plane before it enables the
+	 * CRTC, so flush_work of a modeset commit ran while the pacer was
+	 * still off and left the damage behind. Send it now.
+	 *
+	 * The flips of that commit, including the fake event of
+	 * drm_atomic_helper_setup_commit(), wait there as well. Without a
+	 * frame to carry them they complete right here, or flip_done of
+	 * the modeset would never signal.
+	 */
+	spin_lock(&ms912x->damage_lock);
+	if (!ms912x->flush_fb || ms912x_damage_empty(&ms912x->damage))
+		list_splice_tail_init(&ms912x->events, &events);
+	spin_unlock(&ms912x->damage_lock);
+	ms912x_vblank_send_events(ms912x, &events);
+
+	queue_work(system_highpri_wq, &ms912x->flush_work);
+}
+
+static void ms912x_pacer_stop(struct ms912x_device *ms912x)
+{
+	struct drm_framebuffer *fb;
+	LIST_HEAD(events);
+
+	mutex_lock(&ms912x->flush_lock);
+	ms912x->flush_enabled = false;
+	mutex_unlock(&ms912x->flush_lock);
+
+	hrtimer_cancel(&ms912x->flush_timer);
+	cancel_work_sync(&ms912x->flush_work);
+
+	mutex_lock(&ms912x->flush_lock);
+	ms912x_damage_init(&ms912x->flush_damage);
+	ms912x->flush_since = 0;
+	list_splice_init(&ms912x->flush_events, &events);
+	mutex_unlock(&ms912x->flush_lock);
+
+	spin_lock(&ms912x->damage_lock);
+	fb = ms912x_flush_set_fb(ms912x, NULL);
+	ms912x_damage_init(&ms912x->damage);
+	ms912x->damage_since = 0;
+	list_splice_tail_init(&ms912x->events, &events);
+	spin_unlock(&ms912x->damage_lock);
+
+	/* Frames that will never be sent still complete their flips */
+	ms912x_vblank_send_events(ms912x, &events);
+
+	if (fb)
+		drm_framebuffer_put(fb);
+}
+
 static void ms912x_pipe_enable(struct drm_simple_display_pipe *pipe,
 			       struct drm_crtc_state *crtc_state,
 			       struct drm_plane_state *plane_state)
@@ -188,22 +553,57 @@ static void ms912x_pipe_enable(struct drm_simple_display_pipe *pipe,
 
 	pr_info("ms912x: [%s] enabling display pipe, mode: %dx%d@%dHz\n",
 	        ms912x->device_name, mode->hdisplay, mode->vdisplay, drm_mode_vrefresh(mode));
-	
-	ms912x_power_on(ms912x);
-
-	if (crtc_state->mode_changed) {
-		const struct ms912x_mode *ms_mode = ms912x_get_mode(mode);
-		if (IS_ERR(ms_mode)) {
-			pr_err("ms912x: [%s] failed to get mode for %dx%d@%dHz: %ld\n",
-			       ms912x->device_name, mode->hdisplay, mode->vdisplay,
-			       drm_mode_vrefresh(mode), PTR_ERR(ms_mode));
-		} else {
-			pr_info("ms912x: [%s] setting resolution: %dx%d@%dHz, mode=0x%04x\n",
-			        ms912x->device_name, ms_mode->width, ms_mode->height,
-			        ms_mode->hz, ms_mode->mode);
-			ms912x_set_resolution(ms912x, ms_mode);
-		}
+
+	struct ms912x_crtc_state *state = to_ms912x_crtc_state(crtc_state);
+
+	ms912x->pix_fmt = state->pix_fmt ? state->pix_fmt :
+					   ms912x_mode_pix_fmt(ms912x, mode);
+	ms912x->cpp = ms912x_pixfmt_cpp(ms912x->pix_fmt);
+
+	if (state->buffers) {
+		ms912x_ring_install(ms912x, state->buffers);
+		state->buffers = NULL;
+	} else if (!ms912x_ring_buffers_fit(ms912x, mode->hdisplay,
+					    mode->vdisplay, ms912x->cpp)) {
+		/* Enabled without a modeset check, e.g. on resume */
+		struct ms912x_ring_buffers *buffers =
+			ms912x_ring_buffers_alloc(ms912x, mode->hdisplay,
+						  mode->vdisplay, ms912x->cpp);
+
+		if (!IS_ERR(buffers))
+			ms912x_ring_install(ms912x, buffers);
 	}
+
+	const struct ms912x_mode *ms_mode = ms912x_get_mode(mode);
+	struct ms912x_mode hw_mode;
+
+	/*
+	 * Power and mode go out as one register batch. The mode is passed on
+	 * DPMS on and resume too, the register shadow leaves out whatever the
+	 * device still holds.
+	 */
+	if (IS_ERR(ms_mode)) {
+		pr_err("ms912x: [%s] failed to get mode for %dx%d@%dHz: %ld\n",
+		       ms912x->device_name, mode->hdisplay, mode->vdisplay,
+		       drm_mode_vrefresh(mode), PTR_ERR(ms_mode));
+		ms912x_power_on(ms912x, NULL);
+	} else {
+		hw_mode = *ms_mode;
+		hw_mode.pix_fmt = ms912x->pix_fmt;
+		if (crtc_state->mode_changed)
+			pr_info("ms912x: [%s] setting resolution: %dx%d@%dHz, mode=0x%04x, %s\n",
+			        ms912x->device_name, ms_mode->width,
+			        ms_mode->height, ms_mode->hz, ms_mode->mode,
+			        hw_mode.pix_fmt == MS912X_PIXFMT_RGB ? "RGB" : "UYVY");
+		ms912x_power_on(ms912x, &hw_mode);
+	}
+
+	/* flush_work uses the tile hashes as soon as the pacer runs */
+	ms912x_tile_hash_alloc(ms912x, mode->hdisplay, mode->vdisplay);
+	ms912x_pacer_start(ms912x, IS_ERR(ms_mode) ? drm_mode_vrefresh(mode) :
+						     ms_mode->hz);
+
+	drm_crtc_vblank_on(&pipe->crtc);
 }
 
 static void ms912x_pipe_disable(struct drm_simple_display_pipe *pipe)
@@ -212,8 +612,27 @@ static void ms912x_pipe_disable(struct drm_simple_display_pipe *pipe)
 	
 	// Добавляем дополнительную диагностику при отключении пайплайна
 	pr_info("ms912x: [%s] disabling display pipe\n", ms912x->device_name);
+
+	drm_crtc_vblank_off(&pipe->crtc);
+	ms912x_pacer_stop(ms912x);
+	ms912x_tile_hash_free(ms912x);
+
+	/* Let the frames already queued reach the device first */
+	if (!ms912x_ring_drain(ms912x, 1000))
+		pr_debug("ms912x: [%s] request ring not drained before power off\n",
+			 ms912x->device_name);
 	
 	ms912x_power_off(ms912x);
+
+	/*
+	 * Nothing to send while off, let the pool have the buffers. A
+	 * modeset that enables the pipe again keeps them for pipe_enable,
+	 * which swaps in new ones only if the mode needs a different size.
+	 */
+	if (pipe->crtc.state->active)
+		ms912x_ring_reset(ms912x);
+	else
+		ms912x_ring_release(ms912x);
 }
 
 static enum drm_mode_status
@@ -234,95 +653,242 @@ ms912x_pipe_mode_valid(struct drm_simple_display_pipe *pipe,
 	}
 }
 
+/* Pick the wire format of a new mode, the buffers come in prepare_fb */
 static int ms912x_pipe_check(struct drm_simple_display_pipe *pipe,
 			     struct drm_plane_state *new_plane_state,
 			     struct drm_crtc_state *new_crtc_state)
 {
+	struct ms912x_device *ms912x = to_ms912x(pipe->crtc.dev);
+	struct ms912x_crtc_state *state = to_ms912x_crtc_state(new_crtc_state);
+
+	if (!new_crtc_state->active ||
+	    !drm_atomic_crtc_needs_modeset(new_crtc_state))
+		return 0;
+
+	state->pix_fmt = ms912x_mode_pix_fmt(ms912x, &new_crtc_state->mode);
+
 	return 0;
 }
 
-#define INVALID_COORD 0x7fffffff
-
-static void ms912x_update_rect_init(struct drm_rect *rect)
+/**
+ * ms912x_pipe_prepare_fb - Allocate transfer buffers for a new mode
+ *
+ * Runs for commits only, never for TEST_ONLY checks, and before the
+ * point of no return, so a failed allocation fails the commit instead of
+ * the device going dark. pipe_enable swaps the new buffers in. A modeset
+ * to a mode of the same size and wire format keeps the installed ones,
+ * see ms912x_pipe_disable().
+ */
+static int ms912x_pipe_prepare_fb(struct drm_simple_display_pipe *pipe,
+				  struct drm_plane_state *plane_state)
 {
-	rect->x1 = INVALID_COORD;
-	rect->y1 = INVALID_COORD;
-	rect->x2 = 0;
-	rect->y2 = 0;
+	struct ms912x_device *ms912x = to_ms912x(pipe->crtc.dev);
+	const struct drm_crtc_state *old_crtc_state;
+	struct drm_crtc_state *new_crtc_state;
+	const struct drm_display_mode *mode;
+	struct ms912x_ring_buffers *buffers;
+	struct ms912x_crtc_state *state;
+
+	new_crtc_state = drm_atomic_get_new_crtc_state(plane_state->state,
+						       &pipe->crtc);
+	if (!new_crtc_state || !new_crtc_state->active ||
+	    !drm_atomic_crtc_needs_modeset(new_crtc_state))
+		goto out;
+
+	state = to_ms912x_crtc_state(new_crtc_state);
+	mode = &new_crtc_state->mode;
+	old_crtc_state = drm_atomic_get_old_crtc_state(plane_state->state,
+						       &pipe->crtc);
+	if (state->buffers ||
+	    (old_crtc_state->active &&
+	     old_crtc_state->mode.hdisplay == mode->hdisplay &&
+	     old_crtc_state->mode.vdisplay == mode->vdisplay &&
+	     to_ms912x_crtc_state(old_crtc_state)->pix_fmt == state->pix_fmt))
+		goto out;
+
+	buffers = ms912x_ring_buffers_alloc(ms912x, mode->hdisplay,
+					    mode->vdisplay,
+					    ms912x_pixfmt_cpp(state->pix_fmt));
+	if (IS_ERR(buffers)) {
+		drm_dbg_kms(&ms912x->drm,
+			    "no transfer buffers for %dx%d: %ld\n",
+			    mode->hdisplay, mode->vdisplay, PTR_ERR(buffers));
+		return PTR_ERR(buffers);
+	}
+	state->buffers = buffers;
+
+out:
+	return drm_gem_plane_helper_prepare_fb(&pipe->plane, plane_state);
 }
 
-static bool ms912x_rect_is_valid(const struct drm_rect *rect)
+static void ms912x_pipe_reset_crtc(struct drm_simple_display_pipe *pipe)
 {
-	bool valid = (rect->x1 <= rect->x2 && rect->y1 <= rect->y2);
-	pr_debug("ms912x: rectangle validity check: x1=%d, y1=%d, x2=%d, y2=%d, valid=%s\n",
-	         rect->x1, rect->y1, rect->x2, rect->y2, valid ? "true" : "false");
-	return valid;
+	struct drm_crtc *crtc = &pipe->crtc;
+	struct ms912x_crtc_state *state;
+
+	if (crtc->state)
+		pipe->funcs->destroy_crtc_state(pipe, crtc->state);
+
+	state = kzalloc(sizeof(*state), GFP_KERNEL);
+	if (state)
+		__drm_atomic_helper_crtc_reset(crtc, &state->base);
+	else
+		__drm_atomic_helper_crtc_reset(crtc, NULL);
 }
 
+static struct drm_crtc_state *
+ms912x_pipe_duplicate_crtc_state(struct drm_simple_display_pipe *pipe)
+{
+	struct drm_crtc *crtc = &pipe->crtc;
+	struct ms912x_crtc_state *state;
+
+	if (WARN_ON(!crtc->state))
+		return NULL;
+
+	state = kzalloc(sizeof(*state), GFP_KERNEL);
+	if (!state)
+		return NULL;
+
+	/* Buffers stay with the state that allocated them */
+	__drm_atomic_helper_crtc_duplicate_state(crtc, &state->base);
+	state->pix_fmt = to_ms912x_crtc_state(crtc->state)->pix_fmt;
+
+	return &state->base;
+}
 
-static void ms912x_merge_rects(struct drm_rect *dest, const struct drm_rect *r1,
-			       const struct drm_rect *r2)
+static void ms912x_pipe_destroy_crtc_state(struct drm_simple_display_pipe *pipe,
+					   struct drm_crtc_state *crtc_state)
 {
-	if (!ms912x_rect_is_valid(r1)) {
-		*dest = *r2;
-		return;
-	}
-	if (!ms912x_rect_is_valid(r2)) {
-		*dest = *r1;
-		return;
-	}
-	dest->x1 = min(r1->x1, r2->x1);
-	dest->y1 = min(r1->y1, r2->y1);
-	dest->x2 = max(r1->x2, r2->x2);
-	dest->y2 = max(r1->y2, r2->y2);
+	struct ms912x_crtc_state *state = to_ms912x_crtc_state(crtc_state);
+
+	__drm_atomic_helper_crtc_destroy_state(crtc_state);
+	ms912x_ring_buffers_free(to_ms912x(pipe->crtc.dev), state->buffers);
+	kfree(state);
 }
 
+/**
+ * ms912x_pipe_update - Record the damage of a commit
+ *
+ * Only the damage, a framebuffer reference and the page-flip event are
+ * taken here; conversion and USB I/O happen in flush_work, so the commit
+ * does not wait on them. The event is sent once the frame carrying this
+ * damage is on the device.
+ */
 static void ms912x_pipe_update(struct drm_simple_display_pipe *pipe,
 			       struct drm_plane_state *old_state)
 {
+	struct ms912x_device *ms912x = to_ms912x(pipe->crtc.dev);
 	struct drm_plane_state *state = pipe->plane.state;
-	struct drm_shadow_plane_state *shadow_plane_state =
-		to_drm_shadow_plane_state(state);
-	
-	if (!state->fb)
+	struct drm_crtc_state *crtc_state = pipe->crtc.state;
+	struct drm_pending_vblank_event *event = crtc_state->event;
+	LIST_HEAD(events);
+
+	crtc_state->event = NULL;
+	if (event)
+		list_add_tail(&event->base.link, &events);
+
+	/* No frame will carry it */
+	if (!state->fb || !crtc_state->active) {
+		ms912x_vblank_send_events(ms912x, &events);
 		return;
+	}
 		
-	struct ms912x_device *ms912x = to_ms912x(state->fb->dev);
-	struct drm_rect current_rect, rect;
-
-	if (!ms912x_rect_is_valid(&ms912x->update_rect))
-		ms912x_update_rect_init(&ms912x->update_rect);
-
-	if (drm_atomic_helper_damage_merged(old_state, state, &current_rect)) {
-		ms912x_merge_rects(&rect, &current_rect, &ms912x->update_rect);
-
-		int ret = ms912x_fb_send_rect(
-			state->fb, &shadow_plane_state->data[0], &rect);
-		if (ret == 0) {
-			ms912x_update_rect_init(&ms912x->update_rect);
-		} else {
-			ms912x_merge_rects(&ms912x->update_rect,
-					   &ms912x->update_rect, &rect);
-		}
+	const struct drm_display_mode *mode = &crtc_state->mode;
+	int width = min_t(int, state->fb->width, mode->hdisplay);
+	int height = min_t(int, state->fb->height, mode->vdisplay);
+	struct drm_atomic_helper_damage_iter iter;
+	struct drm_framebuffer *old_fb;
+	struct drm_rect clip;
+
+	spin_lock(&ms912x->damage_lock);
+
+	ms912x_stats_inc(ms912x, MS912X_STAT_COMMITS);
+	if (ms912x_damage_empty(&ms912x->damage))
+		ms912x->damage_since = ktime_get();
+	else
+		ms912x_stats_inc(ms912x, MS912X_STAT_COALESCED);
+
+	/* Keep the clips apart, ms912x_damage_add() merges where it pays off */
+	drm_atomic_helper_damage_iter_init(&iter, old_state, state);
+	drm_atomic_for_each_plane_damage(&iter, &clip) {
+		if (ms912x_damage_align(&clip, width, height))
+			ms912x_damage_add(&ms912x->damage, &clip, ms912x->cpp);
 	}
+
+	/* flush_work needs the framebuffer after this commit is done */
+	old_fb = ms912x_flush_set_fb(ms912x, state->fb);
+	list_splice_tail(&events, &ms912x->events);
+
+	spin_unlock(&ms912x->damage_lock);
+
+	if (old_fb)
+		drm_framebuffer_put(old_fb);
+
+	queue_work(system_highpri_wq, &ms912x->flush_work);
+}
+
+static int ms912x_pipe_enable_vblank(struct drm_simple_display_pipe *pipe)
+{
+	return ms912x_vblank_enable(to_ms912x(pipe->crtc.dev));
+}
+
+static void ms912x_pipe_disable_vblank(struct drm_simple_display_pipe *pipe)
+{
+	ms912x_vblank_disable(to_ms912x(pipe->crtc.dev));
 }
 
 static const struct drm_simple_display_pipe_funcs ms912x_pipe_funcs = {
 	.enable = ms912x_pipe_enable,
 	.disable = ms912x_pipe_disable,
 	.check = ms912x_pipe_check,
+	.prepare_fb = ms912x_pipe_prepare_fb,
 	.mode_valid = ms912x_pipe_mode_valid,
 	.update = ms912x_pipe_update,
+	.reset_crtc = ms912x_pipe_reset_crtc,
+	.duplicate_crtc_state = ms912x_pipe_duplicate_crtc_state,
+	.destroy_crtc_state = ms912x_pipe_destroy_crtc_state,
+	.enable_vblank = ms912x_pipe_enable_vblank,
+	.disable_vblank = ms912x_pipe_disable_vblank,
 	DRM_GEM_SIMPLE_DISPLAY_PIPE_SHADOW_PLANE_FUNCS,
 };
 
+/* XRGB8888 first, it is the format with vector kernels */
 static const uint32_t ms912x_pipe_formats[] = {
 	DRM_FORMAT_XRGB8888,
+	DRM_FORMAT_ARGB8888,
+	DRM_FORMAT_XBGR8888,
+	DRM_FORMAT_RGB565,
+	DRM_FORMAT_UYVY,
+	DRM_FORMAT_YUYV,
 };
 
 
-static DEFINE_MUTEX(yuv_lut_mutex);
-static bool yuv_lut_initialized = false;
+static unsigned int ring_size = MS912X_RING_MIN;
+
+static int ring_size_set(const char *val, const struct kernel_param *kp)
+{
+	unsigned int n;
+	int ret;
+
+	ret = kstrtouint(val, 0, &n);
+	if (ret)
+		return ret;
+
+	if (n < MS912X_RING_MIN || n > MS912X_RING_MAX)
+		return -EINVAL;
+
+	return param_set_uint(val, kp);
+}
+
+static const struct kernel_param_ops ring_size_ops = {
+	.set = ring_size_set,
+	.get = param_get_uint,
+};
+
+module_param_cb(ring_size, &ring_size_ops, &ring_size, 0644);
+MODULE_PARM_DESC(ring_size,
+		 "Frames queued per device, applies to devices probed afterwards (2-8, default: 2)");
+
 static atomic_t device_counter = ATOMIC_INIT(0);
 /**
  * @brief Probe function for ms912x USB device
@@ -332,7 +898,6 @@ static atomic_t device_counter = ATOMIC_INIT(0);
  * device to function as a DRM display device.
  *
  * Initialization steps include:
- * - Initializing YUV lookup table if not already done
  * - Allocating and initializing DRM device structure
  * - Setting up DMA device for buffer sharing
  * - Initializing mode configuration with supported resolutions
@@ -361,15 +926,8 @@ static int ms912x_usb_probe(struct usb_interface *interface,
 		return -EINVAL;
 	}
 
-	mutex_lock(&yuv_lut_mutex);
-	if (!yuv_lut_initialized) {
-		pr_info("ms912x: initializing YUV lookup table\n");
-		ms912x_init_yuv_lut();
-		yuv_lut_initialized = true;
-	}
-	mutex_unlock(&yuv_lut_mutex);
-
 	int ret;
+	unsigned int i = 0;
 	struct ms912x_device *ms912x;
 	struct drm_device *dev;
 	struct usb_device *usb_dev = interface_to_usbdev(interface);
@@ -401,6 +959,13 @@ static int ms912x_usb_probe(struct usb_interface *interface,
 	ms912x->intf = interface;
 	dev = &ms912x->drm;
 
+	/* Idle transfer buffers go with the last adapter on this controller */
+	ret = ms912x_pool_attach(interface, usb_dev->bus->sysdev);
+	if (ret) {
+		pr_err("ms912x: pool_attach failed: %d\n", ret);
+		return ret;
+	}
+
 	pr_debug("ms912x: usb_intf_get_dma_device\n");
 	ms912x->dmadev = usb_intf_get_dma_device(interface);
 
@@ -419,9 +984,15 @@ static int ms912x_usb_probe(struct usb_interface *interface,
 	pr_debug("ms912x: set dev->mode_config\n");
 
 	dev->mode_config.min_width = 0;
-	dev->mode_config.max_width = 2048;
+	dev->mode_config.max_width = 0;
 	dev->mode_config.min_height = 0;
-	dev->mode_config.max_height = 2048;
+	dev->mode_config.max_height = 0;
+	for (i = 0; i < ARRAY_SIZE(ms912x_mode_list); i++) {
+		dev->mode_config.max_width = max(dev->mode_config.max_width,
+						 ms912x_mode_list[i].width);
+		dev->mode_config.max_height = max(dev->mode_config.max_height,
+						  ms912x_mode_list[i].height);
+	}
 	dev->mode_config.funcs = &ms912x_mode_config_funcs;
 	
 	pr_info("ms912x: [%s] mode_config initialized: min_width=%d, max_width=%d, min_height=%d, max_height=%d\n",
@@ -431,38 +1002,73 @@ static int ms912x_usb_probe(struct usb_interface *interface,
 	        dev->mode_config.min_height,
 	        dev->mode_config.max_height);
 
-	pr_debug("ms912x: set_resolution begin\n");
-	ret = ms912x_set_resolution(ms912x, &ms912x_mode_list[0]);
+	ms912x->pix_fmt = MS912X_PIXFMT_UYVY;
+	ms912x->cpp = ms912x_pixfmt_cpp(ms912x->pix_fmt);
+
+	ret = ms912x_stats_init(ms912x);
 	if (ret) {
-		pr_err("ms912x: set_resolution failed: %d\n", ret);
+		pr_err("ms912x: stats_init failed: %d\n", ret);
 		goto err_mode_config_cleanup;
 	}
-	pr_debug("ms912x: set_resolution end\n");
 
-	pr_debug("ms912x: init_request [0] \n");
-	ret = ms912x_init_request(ms912x, &ms912x->requests[0],
-				  2048 * 2048 * 2);
+	ret = ms912x_regs_init(ms912x);
+	if (ret) {
+		pr_err("ms912x: regs_init failed: %d\n", ret);
+		goto err_mode_config_cleanup;
+	}
+	ms912x_edid_init(ms912x);
+	ret = ms912x_hpd_init(ms912x);
 	if (ret) {
-		pr_err("ms912x: init_request [0] failed: %d\n", ret);
+		pr_err("ms912x: hpd_init failed: %d\n", ret);
 		goto err_mode_config_cleanup;
 	}
 
-	pr_debug("ms912x: init_request [1] \n");
-	ret = ms912x_init_request(ms912x, &ms912x->requests[1],
-				  2048 * 2048 * 2);
+	ms912x_diag_init(ms912x);
+
+	ms912x_pacer_init(ms912x);
+	ms912x_vblank_init(ms912x);
+
+	ret = drm_vblank_init(dev, 1);
 	if (ret) {
-		pr_err("ms912x: init_request [1] failed: %d\n", ret);
-		goto err_free_request_0;
+		pr_err("ms912x: drm_vblank_init failed: %d\n", ret);
+		goto err_mode_config_cleanup;
 	}
 
-	pr_debug("ms912x: complete request [1] \n");
-	complete(&ms912x->requests[1].done);
+	pr_debug("ms912x: init_urbs\n");
+	ret = ms912x_init_urbs(ms912x);
+	if (ret) {
+		pr_err("ms912x: init_urbs failed: %d\n", ret);
+		goto err_mode_config_cleanup;
+	}
+
+	ret = ms912x_convert_workers_init(ms912x, dev->mode_config.max_width);
+	if (ret) {
+		pr_err("ms912x: convert_workers_init failed: %d\n", ret);
+		goto err_free_urbs;
+	}
+
+	ms912x->ring_size = READ_ONCE(ring_size);
+	ms912x->requests = drmm_kcalloc(dev, ms912x->ring_size,
+					sizeof(*ms912x->requests), GFP_KERNEL);
+	if (!ms912x->requests) {
+		ret = -ENOMEM;
+		goto err_convert_workers_fini;
+	}
+
+	for (i = 0; i < ms912x->ring_size; i++) {
+		pr_debug("ms912x: init_request [%u] \n", i);
+		ret = ms912x_init_request(ms912x, &ms912x->requests[i]);
+		if (ret) {
+			pr_err("ms912x: init_request [%u] failed: %d\n", i, ret);
+			goto err_free_requests;
+		}
+	}
 
 	pr_debug("ms912x: connector_init \n");
 	ret = ms912x_connector_init(ms912x);
 	if (ret) {
 		pr_err("ms912x: connector_init failed: %d\n", ret);
-		goto err_free_request_1;
+		goto err_free_requests;
 	}
 
 	pr_debug("ms912x: drm_simple_display_pipe_init \n");
@@ -474,7 +1080,7 @@ static int ms912x_usb_probe(struct usb_interface *interface,
 	if (ret) {
 		pr_err("ms912x: [%s] failed to initialize display pipe: %d\n",
 		       ms912x->device_name, ret);
-		goto err_free_request_1;
+		goto err_free_requests;
 	}
 	
 	pr_info("ms912x: [%s] display pipe initialized successfully\n", ms912x->device_name);
@@ -492,6 +1098,12 @@ static int ms912x_usb_probe(struct usb_interface *interface,
 
 	dev->dev_private = ms912x;
 
+	ms912x_debugfs_init(ms912x);
+
+	/* The first probe of the connector, by fbdev, finds the cache filled */
+	ms912x_edid_refresh(ms912x);
+	flush_delayed_work(&ms912x->edid_work);
+
 	pr_debug("ms912x: drm_dev_register \n");
 	ret = drm_dev_register(dev, 0);
 	if (ret) {
@@ -502,6 +1114,8 @@ static int ms912x_usb_probe(struct usb_interface *interface,
 	
 	pr_info("ms912x: [%s] drm device registered successfully\n", ms912x->device_name);
 
+	ms912x_hpd_start(ms912x);
+
 	pr_info("ms912x: drm_fbdev_generic_setup \n");
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(6, 11, 0))
 	drm_fbdev_generic_setup(dev, 0);
@@ -513,23 +1127,21 @@ static int ms912x_usb_probe(struct usb_interface *interface,
 
 	pr_info("ms912x: probe completed successfully for device %s\n", ms912x->device_name);
 	
-	// Запускаем диагностику устройства после успешной инициализации
-	int diag_result = ms912x_run_diagnostics(ms912x);
-	if (diag_result < 0) {
-		pr_warn("ms912x: [%s] diagnostics failed: %d\n",
-		        ms912x->device_name, diag_result);
-	} else {
-		pr_info("ms912x: [%s] diagnostics passed\n", ms912x->device_name);
-	}
+	// Диагностика не нужна для первого кадра, запускаем её позже
+	ms912x_diag_schedule(ms912x);
 	
 	return 0;
 
 err_kms_poll_fini:
 	drm_kms_helper_poll_fini(dev);
-err_free_request_1:
-	ms912x_free_request(&ms912x->requests[1]);
-err_free_request_0:
-	ms912x_free_request(&ms912x->requests[0]);
+	ms912x_edid_fini(ms912x);
+err_free_requests:
+	while (i--)
+		ms912x_free_request(&ms912x->requests[i]);
+err_convert_workers_fini:
+	ms912x_convert_workers_fini(ms912x);
+err_free_urbs:
+	ms912x_free_urbs(ms912x);
 err_mode_config_cleanup:
 	// Note: drmm_mode_config_init автоматически освобождает ресурсы
 err_put_device:
@@ -557,6 +1169,8 @@ static void ms912x_usb_disconnect(struct usb_interface *interface)
 	}
 	
 	struct ms912x_device *ms912x = usb_get_intfdata(interface);
+	unsigned int i;
+
 	if (!ms912x) {
 		pr_warn("ms912x: no device data found\n");
 		return;
@@ -572,51 +1186,32 @@ static void ms912x_usb_disconnect(struct usb_interface *interface)
 	
 	// Устанавливаем флаг отключения до выполнения других операций
 	WRITE_ONCE(dev->unplugged, true);
-
-	// Отменяем все работы
-	if (cancel_work_sync(&ms912x->requests[0].work))
-		pr_debug("ms912x: cancelled work [0] for device %s\n", ms912x->device_name);
-		
-	if (cancel_work_sync(&ms912x->requests[1].work))
-		pr_debug("ms912x: cancelled work [1] for device %s\n", ms912x->device_name);
+	wake_up_all(&ms912x->tx_wait);
 
 	// Завершаем работу с DRM
 	drm_kms_helper_poll_fini(dev);
 	
-	// Принудительно завершаем все рабочие потоки перед отключением
-	if (cancel_work_sync(&ms912x->requests[0].work))
-		pr_debug("ms912x: [%s] cancelled work [0] during disconnect\n", ms912x->device_name);
-		
-	if (cancel_work_sync(&ms912x->requests[1].work))
-		pr_debug("ms912x: [%s] cancelled work [1] during disconnect\n", ms912x->device_name);
-	
-	// Ждем завершения всех текущих операций
-	wait_for_completion_timeout(&ms912x->requests[0].done, msecs_to_jiffies(1000));
-	wait_for_completion_timeout(&ms912x->requests[1].done, msecs_to_jiffies(1000));
-	
 	// Проверяем состояние устройства перед отключением
 	if (READ_ONCE(dev->registered)) {
 		drm_dev_unplug(dev);
 		drm_atomic_helper_shutdown(dev);
 	}
+
+	ms912x_hpd_stop(ms912x);
+	ms912x_diag_cancel(ms912x);
+	ms912x_edid_fini(ms912x);
 	
-	// Принудительно завершаем все рабочие потоки перед отключением
-	if (cancel_work_sync(&ms912x->requests[0].work))
-		pr_debug("ms912x: [%s] cancelled work [0] during disconnect\n", ms912x->device_name);
-		
-	if (cancel_work_sync(&ms912x->requests[1].work))
-		pr_debug("ms912x: [%s] cancelled work [1] during disconnect\n", ms912x->device_name);
-	
-	// Ждем завершения всех текущих операций
-	wait_for_completion_timeout(&ms912x->requests[0].done, msecs_to_jiffies(1000));
-	wait_for_completion_timeout(&ms912x->requests[1].done, msecs_to_jiffies(1000));
-	
-	drm_dev_unplug(dev);
-	drm_atomic_helper_shutdown(dev);
+	// Останавливаем таймер кадров и освобождаем framebuffer
+	ms912x_pacer_stop(ms912x);
+	ms912x_vblank_fini(ms912x);
+	ms912x_convert_workers_fini(ms912x);
+
+	// Останавливаем передачу кадров, кадры в кольце отбрасываются
+	ms912x_free_urbs(ms912x);
 
 	// Освобождаем запросы
-	ms912x_free_request(&ms912x->requests[0]);
-	ms912x_free_request(&ms912x->requests[1]);
+	for (i = 0; i < ms912x->ring_size; i++)
+		ms912x_free_request(&ms912x->requests[i]);
 
 	// Освобождаем устройство DMA
 	if (ms912x->dmadev) {
@@ -673,8 +1268,40 @@ static struct usb_driver ms912x_driver = {
 	.disconnect = ms912x_usb_disconnect,
 	.suspend = ms912x_usb_suspend,
 	.resume = ms912x_usb_resume,
+	.reset_resume = ms912x_usb_reset_resume,
+	/* Adapters behind a dock come up in parallel */
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(6, 8, 0))
+	.drvwrap.driver.probe_type = PROBE_PREFER_ASYNCHRONOUS,
+#else
+	.driver.probe_type = PROBE_PREFER_ASYNCHRONOUS,
+#endif
 	.id_table = id_table,
 };
-module_usb_driver(ms912x_driver);
+
+static int __init ms912x_init(void)
+{
+	int ret;
+
+	ms912x_convert_init();
+
+	ret = ms912x_pool_init();
+	if (ret)
+		return ret;
+
+	ret = usb_register(&ms912x_driver);
+	if (ret)
+		ms912x_pool_exit();
+
+	return ret;
+}
+
+static void __exit ms912x_exit(void)
+{
+	usb_deregister(&ms912x_driver);
+	ms912x_pool_exit();
+}
+
+module_init(ms912x_init);
+module_exit(ms912x_exit);
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("USB to HDMI driver for ms912x");
@@ -2,15 +2,27 @@
 #ifndef MS912X_H
 #define MS912X_H
 
+#include <linux/completion.h>
+#include <linux/hrtimer.h>
+#include <linux/kthread.h>
 #include <linux/mm_types.h>
-#include <linux/scatterlist.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/semaphore.h>
+#include <linux/spinlock.h>
 #include <linux/usb.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #include <drm/drm_device.h>
+#include <drm/drm_edid.h>
 #include <drm/drm_framebuffer.h>
 #include <drm/drm_gem.h>
+#include <drm/drm_rect.h>
 #include <drm/drm_simple_kms_helper.h>
 
+#include "../components/ms912x_convert.h"
+#include "../components/ms912x_damage.h"
 #include "../components/ms912x_diagnostics.h"
 
 #define DRIVER_NAME "ms912x"
@@ -22,18 +34,316 @@
 #define DRIVER_PATCHLEVEL 1
 
 #define MS912X_TOTAL_URBS 8
+#define MS912X_MAX_TRANSFER_LENGTH 65536
+#define MS912X_REQUEST_TIMEOUT_MS 5000
+
+#define MS912X_RING_MIN 2
+#define MS912X_RING_MAX 8
+
+/* Life cycle of a request ring slot */
+enum ms912x_slot_state {
+	/* Owned by the producer, may be filled */
+	MS912X_SLOT_FREE,
+	/* Published, the consumer may claim it while it is converted */
+	MS912X_SLOT_QUEUED,
+	/* Taken back by the producer to fold newer damage into it */
+	MS912X_SLOT_FILLING,
+	/* Claimed by the consumer, on the wire until the last URB is back */
+	MS912X_SLOT_SENDING,
+};
 
 struct ms912x_usb_request {
+	/* CPU mapping of xfer */
 	void *transfer_buffer;
+	struct ms912x_xfer_buf *xfer;
 	void *temp_buffer;
 	struct ms912x_device *ms912x;
 	size_t transfer_len;
 	size_t alloc_len;
-	struct sg_table transfer_sgt;
-	struct usb_sg_request sgr;
-	struct work_struct work;
+	/* Size of temp_buffer, one line of the mode at 4 bytes per pixel, only
+	 * used as bounce buffer for framebuffers in I/O memory
+	 */
+	size_t temp_len;
+	/* Bytes converted so far, published to the consumer */
+	size_t ready_len;
+	/* enum ms912x_slot_state */
+	atomic_t state;
+	/* Damage carried by this slot, one wire segment per rect */
+	struct ms912x_damage damage;
+	/* Every segment goes out as a bulk transfer of its own */
+	bool split;
+	/* Start and end of each segment in transfer_buffer */
+	size_t seg_start[MS912X_MAX_DAMAGE_RECTS];
+	size_t seg_end[MS912X_MAX_DAMAGE_RECTS];
+	/* Consumer + URBs in flight, the last put frees the slot */
+	atomic_t pending_urbs;
+	int status;
 	struct timer_list timer;
+	/* First chunk handed to the transmitter, for the governor */
+	ktime_t sent_at;
+	/* Oldest commit whose damage the frame carries, 0 if unknown */
+	ktime_t commit_at;
+	/* Page-flip events sent once the frame is on the device */
+	struct list_head events;
+};
+
+/* Threads converting one frame, see ms912x_convert_workers_init() */
+#define MS912X_MAX_CONVERT_THREADS 8
+#define MS912X_MAX_BANDS 64
+
+/**
+ * struct ms912x_band - Lines of one segment converted as a unit
+ * @seg: segment (damage rect) of the band
+ * @y1: first line
+ * @y2: line after the last one
+ * @start: offset of the band in the transfer buffer
+ * @end: offset right after the band
+ * @pos: converted up to here, protected by the job's lock
+ */
+struct ms912x_band {
+	unsigned int seg;
+	int y1;
+	int y2;
+	size_t start;
+	size_t end;
+	size_t pos;
+};
+
+/**
+ * struct ms912x_convert_job - Conversion of one frame in bands
+ * @request: request being converted
+ * @src: mapping of @fb
+ * @fb: framebuffer
+ * @kernel: conversion kernel shared by all threads
+ * @stream: @src is I/O memory read with ms912x_copy_from_wc()
+ * @cpp: bytes per pixel of the wire format
+ * @bands: bands in buffer order
+ * @nr_bands: bands in use
+ * @next_band: next band to take
+ * @lock: protects the band positions, @front and @published
+ * @front: first band not completely converted
+ * @published: ready_len published to the transmitter
+ * @running: threads still converting
+ * @done: completed by the last helper thread
+ */
+struct ms912x_convert_job {
+	struct ms912x_usb_request *request;
+	const struct iosys_map *src;
+	struct drm_framebuffer *fb;
+	const struct ms912x_convert_kernel *kernel;
+	bool stream;
+	/* Bytes per pixel on the wire and in the framebuffer */
+	unsigned int cpp;
+	unsigned int src_cpp;
+	struct ms912x_band bands[MS912X_MAX_BANDS];
+	unsigned int nr_bands;
+	atomic_t next_band;
+	spinlock_t lock;
+	unsigned int front;
+	size_t published;
+	atomic_t running;
+	struct completion done;
+};
+
+struct ms912x_convert_worker {
+	struct work_struct work;
+	struct ms912x_device *ms912x;
+	/* Line buffer, one line of the widest mode at 4 bytes per pixel */
+	u32 *temp_buffer;
+};
+
+/* One bulk URB carrying a chunk of at most tx_chunk_len bytes */
+struct ms912x_urb {
+	struct urb *urb;
+	struct ms912x_device *ms912x;
+	struct ms912x_usb_request *request;
+	struct list_head entry;
+};
+
+/**
+ * struct ms912x_xfer_buf - Transfer buffer, DMA mapped once, see ms912x_pool.c
+ * @entry: link in the pool while idle
+ * @dev: DMA device of the host controller, holds a reference
+ * @vaddr: CPU mapping of all chunks, in order
+ * @len: size requested
+ * @nr_chunks: number of physically contiguous chunks
+ * @chunk_shift: log2 of the chunk size
+ * @chunks: first page of each chunk
+ * @dma: DMA address of each chunk, NULL if the controller does not do DMA
+ */
+struct ms912x_xfer_buf {
+	struct list_head entry;
+	struct device *dev;
+	void *vaddr;
+	size_t len;
+	unsigned int nr_chunks;
+	unsigned int chunk_shift;
+	struct page **chunks;
+	dma_addr_t *dma;
+};
+
+static inline size_t ms912x_xfer_buf_chunk_len(const struct ms912x_xfer_buf *buf)
+{
+	return 1UL << buf->chunk_shift;
+}
+
+static inline dma_addr_t ms912x_xfer_buf_dma(const struct ms912x_xfer_buf *buf,
+					     size_t offset)
+{
+	return buf->dma[offset >> buf->chunk_shift] +
+	       (offset & (ms912x_xfer_buf_chunk_len(buf) - 1));
+}
+
+/**
+ * struct ms912x_ring_buffers - Buffers of the request ring for one mode
+ * @count: number of buffers of each kind, the ring size
+ * @transfer_len: size of each transfer buffer
+ * @temp_len: size of each line bounce buffer
+ * @transfer: transfer buffers, from the pool
+ * @temp: line bounce buffers
+ *
+ * Allocated in ms912x_pipe_prepare_fb() of a modeset commit and installed
+ * in pipe_enable, see ms912x_ring_install(). TEST_ONLY commits never get
+ * there, so they do not find out whether the buffers fit into memory.
+ */
+struct ms912x_ring_buffers {
+	unsigned int count;
+	size_t transfer_len;
+	size_t temp_len;
+	struct ms912x_xfer_buf *transfer[MS912X_RING_MAX];
+	void *temp[MS912X_RING_MAX];
+};
+
+/* What tile-hash change detection filtered out */
+struct ms912x_tile_stats {
+	atomic64_t tiles_checked;
+	atomic64_t tiles_unchanged;
+	/* Payload bytes of the reported damage */
+	atomic64_t bytes_checked;
+	/* Payload bytes of it that were not sent */
+	atomic64_t bytes_saved;
+};
+
+/* How the producer got a slot for each frame */
+struct ms912x_ring_stats {
+	/* Took a free slot */
+	atomic64_t queued;
+	/* Ring full, folded into the newest queued frame */
+	atomic64_t replaced;
+	/* Ring full and all on the wire, damage kept for the next update */
+	atomic64_t deferred;
+};
+
+/* Per-CPU frame counters, see ms912x_stats.c */
+enum ms912x_stat {
+	/* Commits that reported damage */
+	MS912X_STAT_COMMITS,
+	/* Commits folded into an update still waiting in the pacer */
+	MS912X_STAT_COALESCED,
+	/* Flushes the pacer held back until the next frame slot */
+	MS912X_STAT_PACED,
+	/* Frames put into the request ring */
+	MS912X_STAT_SUBMITTED,
+	/* Frames that reached the device */
+	MS912X_STAT_SENT,
+	/* Frames lost: transfer or conversion timeout, device gone,
+	 * drm_dev_enter() failed, any other error
+	 */
+	MS912X_STAT_DROP_TIMEOUT,
+	MS912X_STAT_DROP_UNPLUG,
+	MS912X_STAT_DROP_DEV_ENTER,
+	MS912X_STAT_DROP_ERROR,
+	/* Payload of the frames that were sent */
+	MS912X_STAT_BYTES,
+	MS912X_STAT_PIXELS,
+	MS912X_STAT_COUNT
+};
+
+/* Per-CPU log2 histograms of durations in microseconds */
+enum ms912x_hist {
+	/* Converting a frame into its transfer buffer */
+	MS912X_HIST_CONVERT,
+	/* First chunk submitted to last URB completed */
+	MS912X_HIST_USB,
+	/* Oldest commit carried by a frame to the frame on the device */
+	MS912X_HIST_LATENCY,
+	MS912X_HIST_COUNT
+};
+
+/* Bucket n counts durations in [2^(n-1), 2^n) us, the last one the rest */
+#define MS912X_HIST_BUCKETS 24
+
+struct ms912x_stats {
+	u64 counters[MS912X_STAT_COUNT];
+	u64 hist[MS912X_HIST_COUNT][MS912X_HIST_BUCKETS];
+};
+
+/* Control transfers one register batch can hold, a read takes two */
+#define MS912X_REG_BATCH_MAX 16
+/* Registers returned by one read */
+#define MS912X_REG_BURST_LEN 5
+/* Highest register kept in the write shadow */
+#define MS912X_REG_SHADOW_MAX 0x07
+
+/*
+ * Register access, see ms912x_registers.c. lock is held from
+ * ms912x_reg_batch_begin() to ms912x_reg_batch_run().
+ */
+struct ms912x_regs {
+	struct mutex lock;
+	struct usb_anchor anchor;
 	struct completion done;
+	/* URBs in flight plus the submitter's reference */
+	atomic_t pending;
+	/* First error of the batch, also set from completion context */
+	int status;
+	unsigned int count;
+	/* One DMA-safe slot of slot_len bytes per transfer in buf */
+	size_t slot_len;
+	u8 *buf;
+	struct usb_ctrlrequest *setup;
+	struct urb *urbs[MS912X_REG_BATCH_MAX];
+	/* Where the values of each GET_REPORT go, NULL if unused */
+	u8 *vals[MS912X_REG_BATCH_MAX];
+	u8 val_lens[MS912X_REG_BATCH_MAX];
+	/* Transfers whose failure does not fail the batch */
+	bool optional[MS912X_REG_BATCH_MAX];
+	/* Reads return MS912X_REG_BURST_LEN registers */
+	bool burst;
+	/* Last data written to registers 0 to MS912X_REG_SHADOW_MAX */
+	u8 shadow[MS912X_REG_SHADOW_MAX + 1][6];
+	/* Registers whose shadow matches the device, one bit each */
+	unsigned long shadow_valid;
+};
+
+/* Results of the last ms912x_run_diagnostics(). Protected by diag_lock. */
+struct ms912x_diag {
+	/* Number of completed runs, the fields below are valid if non-zero */
+	unsigned int runs;
+	int status;
+	u8 reg30;
+	u8 reg33;
+	u8 reg_c620;
+	u8 edid_header[8];
+	bool edid_header_valid;
+	s64 duration_us;
+};
+
+/* Bandwidth governor, see ms912x_governor.c. Protected by lock. */
+struct ms912x_governor {
+	spinlock_t lock;
+	/* Smoothed bulk throughput in bytes per second, 0 until measured */
+	u64 rate;
+	/* Estimated wire time of the last frame queued */
+	u64 cost_ns;
+	/* Frames go out every divider frame periods */
+	unsigned int divider;
+	/* Consecutive frames that fit into half the interval */
+	unsigned int calm;
+	u64 samples;
+	/* Times the interval was doubled and halved again */
+	u64 throttled;
+	u64 restored;
 };
 
 struct ms912x_device {
@@ -48,14 +358,114 @@ struct ms912x_device {
 	struct drm_connector connector;
 	struct drm_simple_display_pipe display_pipe;
 
-	struct drm_rect update_rect;
+	struct ms912x_regs regs;
+
+	/* EDID cache, see ms912x_connector.c. Protected by edid_lock. */
+	struct mutex edid_lock;
+	const struct drm_edid *edid;
+	/* State of register 0x32 last seen by detect() or edid_work */
+	bool edid_connected;
+	/* edid holds what the connected sink reported */
+	bool edid_ready;
+	unsigned int edid_gen;
+	/* Failed reads since the last refresh */
+	unsigned int edid_retries;
+	u64 edid_reads;
+	struct delayed_work edid_work;
+
+	/* Deferred diagnostics, see ms912x_diagnostics.c */
+	struct mutex diag_lock;
+	struct ms912x_diag diag;
+	struct delayed_work diag_work;
+
+	/* Hotplug poller, see ms912x_hpd_work(). sink_connected is
+	 * read by flush_work, frames are not converted while false.
+	 */
+	struct delayed_work hpd_work;
+	unsigned int hpd_interval;
+	bool sink_connected;
+	struct urb *hpd_urb;
+	void *hpd_buf;
+	/* hpd_urb is running, the poller only backs it up. Cleared
+	 * by the completion when the endpoint fails.
+	 */
+	bool hpd_hints;
+	unsigned long hpd_hint_next;
+
+	/* Wire format of the active mode, MS912X_PIXFMT_*, and its
+	 * bytes per pixel. Set by pipe_enable before the pacer starts.
+	 */
+	int pix_fmt;
+	unsigned int cpp;
+
+	/* Frame pacer, see ms912x_flush_work(). damage, flush_fb and
+	 * the page-flip events are what the commits reported, protected
+	 * by damage_lock. flush_damage, tile-hash filtered and waiting
+	 * for a free slot, flush_events and everything below up to
+	 * next_frame are protected by flush_lock, which only flush_work
+	 * holds for long.
+	 */
+	spinlock_t damage_lock;
+	struct ms912x_damage damage;
+	/* Oldest commit in damage and in flush_damage, 0 while empty */
+	ktime_t damage_since;
+	struct drm_framebuffer *flush_fb;
+	struct list_head events;
+	struct mutex flush_lock;
+	struct ms912x_damage flush_damage;
+	ktime_t flush_since;
+	struct list_head flush_events;
+	bool flush_enabled;
+	ktime_t frame_period;
+	/* Failed sends in a row, stretch the retry interval */
+	unsigned int flush_errors;
+	ktime_t next_frame;
+	struct hrtimer flush_timer;
+	struct work_struct flush_work;
+	struct ms912x_governor governor;
+
+	/* Parallel conversion, one job at a time from flush_work */
+	struct workqueue_struct *convert_wq;
+	struct ms912x_convert_worker *convert_workers;
+	unsigned int nr_convert_workers;
+	struct ms912x_convert_job convert_job;
+
+	/* Emulated vblank, see ms912x_vblank.c */
+	struct hrtimer vblank_timer;
+	ktime_t vblank_period;
+	bool vblank_enabled;
+
+	/* Hash of every 16x1 tile as last queued, NULL if disabled.
+	 * Only used from flush_work, see ms912x_tile_hash.c.
+	 */
+	u64 *tile_hash;
+	unsigned int tile_cols;
+	unsigned int tile_rows;
+	atomic_t tile_hash_stale;
+	struct ms912x_tile_stats tile_stats;
 
-	/* Double buffer to allow memcpy and transfer
-	 * to happen in parallel
+	/* Ring of ring_size requests, so conversion and transfer
+	 * happen in parallel. ring_head is only touched by the
+	 * producer (flush_work), ring_tail only by tx_work. Both
+	 * are slot numbers, always below ring_size.
 	 */
-	int current_request;
-	struct ms912x_usb_request requests[2];
-	unsigned long last_send_jiffies;
+	struct ms912x_usb_request *requests;
+	unsigned int ring_size;
+	unsigned int ring_head;
+	unsigned int ring_tail;
+	struct ms912x_ring_stats ring_stats;
+	struct ms912x_stats __percpu *stats;
+
+	/* Streaming transmitter, see ms912x_tx_work() */
+	struct ms912x_urb urbs[MS912X_TOTAL_URBS];
+	struct list_head free_urbs;
+	spinlock_t urb_lock;
+	struct semaphore free_urb_count;
+	struct usb_anchor tx_anchor;
+	wait_queue_head_t tx_wait;
+	struct kthread_worker *tx_worker;
+	struct kthread_work tx_work;
+	size_t tx_chunk_len;
 };
 
 struct ms912x_request {
@@ -82,6 +492,9 @@ struct ms912x_mode_request {
 	__be16 height;
 } __attribute__((packed));
 
+/* Length of the ff c0 trailer that ends every frame update */
+#define MS912X_END_OF_BUFFER_LEN 8
+
 struct ms912x_frame_update_header {
 	__be16 header; /* ff 00 */
 	u8 x; /* left in multiple of 16 */
@@ -101,38 +514,140 @@ struct ms912x_mode {
 #define MS912X_PIXFMT_UYVY 0x2200
 #define MS912X_PIXFMT_RGB 0x1100
 
+/* Bytes per pixel on the wire: 4:2:2 UYVY or packed 24-bit RGB */
+static inline unsigned int ms912x_pixfmt_cpp(int pix_fmt)
+{
+	return pix_fmt == MS912X_PIXFMT_RGB ? 3 : 2;
+}
+
 #define MS912X_MODE(w, h, z, m, f)                                             \
 	{                                                                      \
 		.width = w, .height = h, .hz = z, .mode = m, .pix_fmt = f      \
 	}
 
-#define MS912X_MAX_TRANSFER_LENGTH 65536
-
 #define to_ms912x(x) container_of(x, struct ms912x_device, drm)
 
+static inline void ms912x_stats_add(struct ms912x_device *ms912x,
+				    enum ms912x_stat stat, u64 val)
+{
+	this_cpu_add(ms912x->stats->counters[stat], val);
+}
+
+static inline void ms912x_stats_inc(struct ms912x_device *ms912x,
+				    enum ms912x_stat stat)
+{
+	this_cpu_inc(ms912x->stats->counters[stat]);
+}
+
+int ms912x_regs_init(struct ms912x_device *ms912x);
+void ms912x_reg_batch_begin(struct ms912x_device *ms912x);
+void ms912x_reg_batch_write(struct ms912x_device *ms912x, u8 address,
+			    const void *data);
+void ms912x_reg_batch_read_burst(struct ms912x_device *ms912x, u16 address,
+				 u8 *buf, unsigned int len);
+void ms912x_reg_batch_read(struct ms912x_device *ms912x, u16 address, u8 *val);
+int ms912x_reg_batch_run(struct ms912x_device *ms912x);
+void ms912x_reg_batch_update(struct ms912x_device *ms912x, u8 address,
+			     const void *data);
+void ms912x_regs_invalidate(struct ms912x_device *ms912x);
 int ms912x_read_byte(struct ms912x_device *ms912x, u16 address);
+int ms912x_read_bytes(struct ms912x_device *ms912x, u16 address, u8 *buf,
+		      size_t len);
 int ms912x_read_edid_block(struct ms912x_device *ms912x, u8 *buf,
 				  unsigned int offset, size_t len);
 int ms912x_connector_init(struct ms912x_device *ms912x);
+void ms912x_edid_init(struct ms912x_device *ms912x);
+void ms912x_edid_fini(struct ms912x_device *ms912x);
+void ms912x_edid_refresh(struct ms912x_device *ms912x);
+int ms912x_hpd_init(struct ms912x_device *ms912x);
+void ms912x_hpd_start(struct ms912x_device *ms912x);
+void ms912x_hpd_stop(struct ms912x_device *ms912x);
 int ms912x_set_resolution(struct ms912x_device *ms912x,
 			  const struct ms912x_mode *mode);
 
-int ms912x_power_on(struct ms912x_device *ms912x);
+int ms912x_power_on(struct ms912x_device *ms912x,
+		    const struct ms912x_mode *mode);
 int ms912x_power_off(struct ms912x_device *ms912x);
 
-int ms912x_fb_send_rect(struct drm_framebuffer *fb, const struct iosys_map *map,
-			struct drm_rect *rect);
+int ms912x_fb_send_damage(struct drm_framebuffer *fb,
+			  const struct iosys_map *map,
+			  struct ms912x_damage *damage,
+			  struct list_head *events);
 
 void ms912x_free_request(struct ms912x_usb_request *request);
 int ms912x_init_request(struct ms912x_device *ms912x,
-			struct ms912x_usb_request *request, size_t len);
-void ms912x_init_yuv_lut(void);
+			struct ms912x_usb_request *request);
+bool ms912x_ring_buffers_fit(struct ms912x_device *ms912x, int width,
+			     int height, unsigned int cpp);
+struct ms912x_ring_buffers *
+ms912x_ring_buffers_alloc(struct ms912x_device *ms912x, int width, int height,
+			  unsigned int cpp);
+void ms912x_ring_buffers_free(struct ms912x_device *ms912x,
+			      struct ms912x_ring_buffers *buffers);
+void ms912x_ring_install(struct ms912x_device *ms912x,
+			 struct ms912x_ring_buffers *buffers);
+void ms912x_ring_reset(struct ms912x_device *ms912x);
+void ms912x_ring_release(struct ms912x_device *ms912x);
+
+int ms912x_pool_init(void);
+void ms912x_pool_exit(void);
+struct ms912x_xfer_buf *ms912x_pool_get(struct device *dev, bool map,
+					size_t len);
+void ms912x_pool_put(struct ms912x_xfer_buf *buf);
+void ms912x_pool_free(struct ms912x_xfer_buf *buf);
+int ms912x_pool_attach(struct usb_interface *intf, struct device *dev);
+void ms912x_xfer_buf_sync(struct ms912x_xfer_buf *buf, size_t offset,
+			  size_t len);
+int ms912x_init_urbs(struct ms912x_device *ms912x);
+int ms912x_convert_workers_init(struct ms912x_device *ms912x, int max_width);
+void ms912x_convert_workers_fini(struct ms912x_device *ms912x);
+void ms912x_free_urbs(struct ms912x_device *ms912x);
+bool ms912x_ring_drain(struct ms912x_device *ms912x, unsigned int timeout_ms);
+
+void ms912x_tile_hash_alloc(struct ms912x_device *ms912x, int width,
+			    int height);
+void ms912x_tile_hash_free(struct ms912x_device *ms912x);
+void ms912x_tile_hash_invalidate(struct ms912x_device *ms912x);
+void ms912x_tile_hash_filter(struct ms912x_device *ms912x,
+			     struct drm_framebuffer *fb,
+			     const struct iosys_map *map,
+			     const struct drm_rect *clip,
+			     struct ms912x_damage *damage);
+
+void ms912x_vblank_init(struct ms912x_device *ms912x);
+void ms912x_vblank_fini(struct ms912x_device *ms912x);
+int ms912x_vblank_enable(struct ms912x_device *ms912x);
+void ms912x_vblank_disable(struct ms912x_device *ms912x);
+void ms912x_vblank_send_events(struct ms912x_device *ms912x,
+			       struct list_head *events);
+
+void ms912x_governor_init(struct ms912x_device *ms912x);
+void ms912x_governor_reset(struct ms912x_device *ms912x);
+void ms912x_governor_sample(struct ms912x_device *ms912x, size_t len,
+			    ktime_t elapsed);
+unsigned int ms912x_governor_update(struct ms912x_device *ms912x, size_t len);
+void ms912x_governor_snapshot(struct ms912x_device *ms912x,
+			      struct ms912x_governor *snap);
+bool ms912x_governor_enabled(void);
+
+int ms912x_stats_init(struct ms912x_device *ms912x);
+void ms912x_stats_time(struct ms912x_device *ms912x, enum ms912x_hist hist,
+		       ktime_t elapsed);
+void ms912x_stats_snapshot(struct ms912x_device *ms912x,
+			   struct ms912x_stats *sum);
+void ms912x_stats_reset(struct ms912x_device *ms912x);
+
+void ms912x_debugfs_init(struct ms912x_device *ms912x);
+void ms912x_debugfs_minor_init(struct drm_minor *minor);
 
 // Diagnostics functions
 int ms912x_diag_check_connection(struct ms912x_device *ms912x);
 int ms912x_diag_check_memory(struct ms912x_device *ms912x);
 int ms912x_diag_check_edid(struct ms912x_device *ms912x);
 int ms912x_run_diagnostics(struct ms912x_device *ms912x);
+void ms912x_diag_init(struct ms912x_device *ms912x);
+void ms912x_diag_schedule(struct ms912x_device *ms912x);
+void ms912x_diag_cancel(struct ms912x_device *ms912x);
 int ms912x_get_device_info(struct ms912x_device *ms912x, char *buf, size_t size);
 
 #endif